@@ -0,0 +1,80 @@
+#!/bin/sh
+# Compare the build time of a generated test suite when every translation
+# unit includes microunit.h (default and MICROUNIT_LEAN modes) and when it
+# imports the microunit C++20 module.
+#
+# Usage: bench/module_build.sh [translation units] [compiler]
+# Defaults to 1000 translation units and g++ (which needs -fmodules-ts).
+set -e
+
+UNITS=${1:-1000}
+CXX=${2:-g++}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+CXXFLAGS="-std=c++20 -O2 -I$ROOT"
+MODULEFLAGS="-fmodules-ts"
+
+# Each translation unit has 10 test cases with 5 assertions each.
+generate() {
+  mode=$1
+  mkdir -p "$WORK/$mode"
+  i=0
+  while [ "$i" -lt "$UNITS" ]; do
+    file="$WORK/$mode/t$i.cpp"
+    case $mode in
+      module) printf 'import microunit;\n#include "microunit_macros.h"\n' ;;
+      *) printf '#include "microunit.h"\n' ;;
+    esac > "$file"
+    printf 'static volatile int value = 1;\n' >> "$file"
+    j=0
+    while [ "$j" -lt 10 ]; do
+      printf 'UNIT(Test_%d_%d) {\n' "$i" "$j"
+      k=0
+      while [ "$k" -lt 5 ]; do
+        printf '  ASSERT_TRUE(value + %d > 0);\n' "$k"
+        k=$((k + 1))
+      done
+      printf '};\n'
+      j=$((j + 1))
+    done >> "$file"
+    i=$((i + 1))
+  done
+  case $mode in
+    module) printf 'import microunit;\n' ;;
+    *) printf '#define MICROUNIT_IMPLEMENTATION\n#include "microunit.h"\n' ;;
+  esac > "$WORK/$mode/main.cpp"
+  printf 'int main() { return microunit::UnitTester::Run() ? 0 : 1; }\n' \
+    >> "$WORK/$mode/main.cpp"
+}
+
+now() {
+  date +%s.%N
+}
+
+build() {
+  mode=$1
+  flags=$2
+  cd "$WORK/$mode"
+  start=$(now)
+  if [ "$mode" = module ]; then
+    $CXX $CXXFLAGS $flags -c -x c++ "$ROOT/microunit.cppm" -o microunit.o
+  fi
+  for file in t*.cpp main.cpp; do
+    $CXX $CXXFLAGS $flags -c "$file" -o "${file%.cpp}.o"
+  done
+  $CXX *.o -o suite
+  end=$(now)
+  ./suite > /dev/null
+  awk -v mode="$mode" -v start="$start" -v end="$end" -v units="$UNITS" \
+    'BEGIN { printf "%-8s %8.1f s  (%.1f ms per translation unit)\n",
+             mode, end - start, 1000 * (end - start) / units }'
+}
+
+for mode in include lean module; do
+  generate $mode
+done
+echo "$UNITS translation units, $CXX $CXXFLAGS"
+build include ""
+build lean "-DMICROUNIT_LEAN"
+build module "$MODULEFLAGS"
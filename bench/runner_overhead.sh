@@ -0,0 +1,181 @@
+#!/bin/sh
+# Measure the cost of microunit itself on generated suites: startup (process
+# start and registration), registration time per test case, run time per test
+# case, memory footprint, output throughput, logging throughput and cost per
+# assertion.
+#
+# Usage: bench/runner_overhead.sh [test cases...]
+# Defaults to suites of 1000, 10000 and 100000 trivial test cases; pass
+# 1000000 to also build the largest suite (about 1000 files to compile).
+# Set CXX and CXXFLAGS to change the compiler and flags.
+set -e
+
+SIZES=${*:-"1000 10000 100000"}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++11 -O2"}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+FLAGS="$CXXFLAGS -DMICROUNIT_LEAN -I$ROOT"
+FILE_UNITS=1000
+
+now() {
+  date +%s.%N
+}
+
+compile() {
+  $CXX $FLAGS -c "$1.cpp" -o "$1.o"
+}
+
+# main.cpp reports on stderr the time from its first static constructor to
+# main, which is the registration of the test cases, and returns right away
+# when called with "startup". Otherwise it also reports the run time and the
+# resident set sizes.
+cat > "$WORK/main.cpp" <<'EOF'
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+#include <sys/resource.h>
+
+// Constructed before the static objects of default priority, i.e. before
+// the registration of the first test case.
+struct StartTime {
+  std::chrono::steady_clock::time_point value{
+    std::chrono::steady_clock::now() };
+};
+static StartTime registration_start __attribute__((init_priority(101)));
+
+static long MaxResidentKilobytes() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+  const std::chrono::duration<double> registration =
+    std::chrono::steady_clock::now() - registration_start.value;
+  if (argc > 1 && strcmp(argv[1], "startup") == 0) {
+    fprintf(stderr, "%.9f\n", registration.count());
+    return 0;
+  }
+  const long registered_kb = MaxResidentKilobytes();
+  const auto start = std::chrono::steady_clock::now();
+  microunit::UnitTester::Run();
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  fprintf(stderr, "%.6f %ld %ld\n", elapsed.count(), registered_kb,
+          MaxResidentKilobytes());
+  return 0;
+}
+EOF
+
+# Trivial test cases, FILE_UNITS per file; suites of different sizes link
+# different numbers of the same files.
+generate_trivial() {
+  file=$1
+  {
+    printf '#include "microunit.h"\nstatic volatile int value = 1;\n'
+    i=0
+    while [ "$i" -lt "$FILE_UNITS" ]; do
+      printf 'UNIT(Test_%d_%d) { ASSERT_TRUE(value > 0); };\n' "$file" "$i"
+      i=$((i + 1))
+    done
+  } > "$WORK/trivial$file.cpp"
+}
+
+# One test case with a dense assertion loop, like Test_Double in sample.cpp,
+# and one that logs many lines.
+cat > "$WORK/dense.cpp" <<'EOF'
+#include "microunit.h"
+static volatile int factor = 2;
+static int Double(int n) { return factor * n; }
+UNIT(Test_Assertions) {
+  for (int i = 0; i < 100000000; ++i) {
+    ASSERT_TRUE(Double(i) == 2 * i);
+  }
+};
+EOF
+cat > "$WORK/logging.cpp" <<'EOF'
+#include "microunit.h"
+UNIT(Test_Logging) {
+  for (int i = 0; i < 1000000; ++i) {
+    LOG_INFO << "Logged line " << i << " of " << 1000000;
+  }
+};
+EOF
+
+cd "$WORK"
+compile main
+compile dense
+compile logging
+$CXX main.o -o empty
+$CXX main.o dense.o -o dense
+$CXX main.o logging.o -o logging
+
+# Best of three wall times of "$@", in seconds.
+best_of_three() {
+  best=
+  for run in 1 2 3; do
+    start=$(now)
+    "$@" > /dev/null 2>&1
+    end=$(now)
+    best=$(awk -v s="$start" -v e="$end" -v b="$best" \
+      'BEGIN { t = e - s; print (b == "" || t < b) ? t : b }')
+  done
+  echo "$best"
+}
+
+# Best of three registration times that "$@" reports, in seconds.
+best_registration() {
+  best=
+  for run in 1 2 3; do
+    "$@" 2> registration.txt
+    best=$(awk -v b="$best" \
+      '{ print (b == "" || $1 < b) ? $1 : b }' registration.txt)
+  done
+  echo "$best"
+}
+
+baseline=$(best_of_three ./empty startup)
+echo "$CXX $CXXFLAGS, lean mode"
+echo "Process start without tests: $(awk -v t="$baseline" \
+  'BEGIN { printf "%.2f ms", 1000 * t }')"
+printf '%-9s %11s %11s %11s %10s %10s %12s\n' "Tests" "Startup" \
+  "Register" "Run/test" "RSS start" "RSS peak" "Output"
+
+files=0
+for size in $SIZES; do
+  needed=$(( (size + FILE_UNITS - 1) / FILE_UNITS ))
+  while [ "$files" -lt "$needed" ]; do
+    generate_trivial "$files"
+    compile "trivial$files"
+    files=$((files + 1))
+  done
+  objects=
+  i=0
+  while [ "$i" -lt "$needed" ]; do
+    objects="$objects trivial$i.o"
+    i=$((i + 1))
+  done
+  $CXX main.o $objects -o suite
+  tests=$((needed * FILE_UNITS))
+  startup=$(best_of_three ./suite startup)
+  registration=$(best_registration ./suite startup)
+  ./suite > output.txt 2> stats.txt
+  bytes=$(wc -c < output.txt)
+  read -r run rss_start rss_peak < stats.txt
+  awk -v n="$tests" -v s="$startup" -v g="$registration" -v r="$run" \
+      -v rs="$rss_start" -v rp="$rss_peak" -v o="$bytes" 'BEGIN {
+    printf "%-9d %8.2f ms %8.1f ns %8.1f ns %7d KB %7d KB %7.1f MB/s\n",
+      n, 1000 * s, 1e9 * g / n, 1e9 * r / n, rs, rp, o / r / 1e6 }'
+done
+
+./dense > /dev/null 2> stats.txt
+read -r run rss_start rss_peak < stats.txt
+awk -v r="$run" 'BEGIN { printf "Assertions: %.2f ns per ASSERT_TRUE\n",
+  1e9 * r / 100000000 }'
+./logging > output.txt 2> stats.txt
+bytes=$(wc -c < output.txt)
+read -r run rss_start rss_peak < stats.txt
+awk -v r="$run" -v o="$bytes" 'BEGIN {
+  printf "Logging: %.0f ns per LOG_INFO line, %.1f MB/s\n",
+    1e9 * r / 1000000, o / r / 1e6 }'
@@ -0,0 +1,88 @@
+/**
+* @file microunit.cppm
+* @brief C++20 module interface unit for microunit. It exports everything
+*        that microunit.h declares, and compiles the library functions once,
+*        in this unit. Macros cannot be exported from a module, so the
+*        translation units that import it get UNIT, ASSERT_TRUE, etc. from the
+*        small microunit_macros.h header.
+* @code{.cpp}
+*  import microunit;
+*  #include "microunit_macros.h"
+*
+*  UNIT(Test_Two_Plus_Two) {
+*    ASSERT_TRUE(2 + 2 == 4);
+*  };
+* @endcode
+*
+* @copyright Copyright (c) 2016-2017, Sebastiao Salvador de Miranda.
+*            All rights reserved. See licence in microunit.h.
+*/
+module;
+// Everything microunit.h includes, so that it is attached to the global
+// module rather than to this one.
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+// Not libstdc++'s <chrono>, see microunit.h.
+#if !defined(__GLIBCXX__)
+#include <chrono>
+#endif
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#if defined(_WIN32)
+#include "windows.h"
+#include <io.h>
+#else
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+export module microunit;
+
+#define MICROUNIT_MODULE_INTERFACE
+export {
+#include "microunit.h"
+}
@@ -5,7 +5,9 @@
 * @brief Tiny library for cpp unit testing. Should work on any c++11 compiler.
 *
 * Simply include this header in your test implementation file (e.g., main.cpp)
-* and call microunit::UnitTester::Run() in the function main(). To register
+* and call microunit::UnitTester::Run() in the function main(). Exactly one
+* translation unit of the program must define MICROUNIT_IMPLEMENTATION before
+* including it, which compiles the runner there. To register
 * a new unit test case, use the macro UNIT (See the example below). Inside the
 * test case body, you can use the following macros to control the result
 * of the test.
@@ -15,7 +17,39 @@
 * @li ASSERT_TRUE(condition) : If the condition does not hold, fail and return.
 * @li ASSERT_FALSE(condition) : If the condition holds, fail and return.
 *
+* Test cases that need setup and teardown can be declared with UNIT_F (one
+* fixture per test case) or UNIT_SHARED (one fixture shared by all the test
+* cases that use it). TYPED_UNIT declares a test case once for a list of
+* types, and STATIC_UNIT declares a test case that is also checked at compile
+* time.
+*
+* By default, the other translation units see the registration, assertion
+* and logging surface, fixtures, clocks and arenas, but neither the runner
+* nor the system headers it needs. Test suites with many translation units
+* can also define MICROUNIT_LEAN before including it everywhere: the header
+* then only declares the registration, assertion and logging surface and
+* includes no standard library headers besides <new>, <stddef.h>, <stdint.h>
+* and <string.h>, and the runner writes its output directly with write(2).
+* Fixtures, clocks and arenas need the full header.
+* All translation units of a program must use the same mode.
+*
+* With C++20 modules, test files can instead import the microunit module
+* (microunit.cppm) and include microunit_macros.h for the macros.
+*
+* For freestanding and embedded targets, define MICROUNIT_FREESTANDING. The
+* library then uses no C++ standard library headers, no heap, no exceptions
+* and no RTTI: test cases are kept in a fixed-size registry (at most
+* MICROUNIT_MAX_UNITS of them), and the output goes one character at a time
+* to the sink given to microunit::SetOutputSink. Only <stddef.h>, <stdint.h>
+* and the <string.h> functions are needed, and the static Registrator
+* objects must be constructed before main, as usual. This mode stays header
+* only, without MICROUNIT_IMPLEMENTATION. Fixtures, clocks and arenas are not
+* available.
+*
 * @code{.cpp}
+*  #define MICROUNIT_IMPLEMENTATION
+*  #include "microunit.h"
+*
 *  UNIT(Test_Two_Plus_Two) {
 *    ASSERT_TRUE(2 + 2 == 4);
 *  };
@@ -59,265 +93,124 @@
 
 #ifndef _MICROUNIT_MICROUNIT_H_
 #define _MICROUNIT_MICROUNIT_H_
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
-#include <map>
-#include <string>
-#include <vector>
-#include <iostream>
 
-/**
-* @brief Helper macros to get current logging filename
-*/
-#if defined(_WIN32)
-#define __FILENAME__ (strrchr(__FILE__, '\\') ?                                \
-strrchr(__FILE__, '\\') + 1 : __FILE__)
+
+#if defined(_MSVC_LANG)
+#define MICROUNIT_CPLUSPLUS _MSVC_LANG
 #else
-#define __FILENAME__ (strrchr(__FILE__, '/') ?                                 \
-strrchr(__FILE__, '/') + 1 : __FILE__)
-#endif
-#define MICROUNIT_SEPARATOR "----------------------------------------"         \
-                            "----------------------------------------"
-#if defined(_WIN32)
-#include "windows.h"
+#define MICROUNIT_CPLUSPLUS __cplusplus
 #endif
 
-namespace microunit {
-const static int COLORCODE_GREY{ 7 };
-const static int COLORCODE_GREEN{ 10 };
-const static int COLORCODE_RED{ 12 };
-const static int COLORCODE_YELLOW{ 14 };
+#if defined(__GNUC__) || defined(__clang__)
+#define MICROUNIT_COLD __attribute__((cold, noinline))
+#define MICROUNIT_COLD_DECLARATION __attribute__((cold))
+#define MICROUNIT_NOINLINE __attribute__((noinline))
+#define MICROUNIT_UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+#elif defined(_MSC_VER)
+#define MICROUNIT_COLD __declspec(noinline)
+#define MICROUNIT_COLD_DECLARATION
+#define MICROUNIT_NOINLINE __declspec(noinline)
+#define MICROUNIT_UNLIKELY(condition) (condition)
+#else
+#define MICROUNIT_COLD
+#define MICROUNIT_COLD_DECLARATION
+#define MICROUNIT_NOINLINE
+#define MICROUNIT_UNLIKELY(condition) (condition)
+#endif
 
 /**
-* @brief Helper class to convert from color codes to ansi escape codes
-*        Used to print color in non-win32 systems.
+* @brief Linkage of the functions implemented by the library: external, as
+*        they are compiled once in the MICROUNIT_IMPLEMENTATION unit or in
+*        the module interface unit (microunit.cppm), and inline in the
+*        header-only MICROUNIT_FREESTANDING mode.
 */
-inline std::string ColorCodeToANSI(const int color_code) {
-  switch (color_code) {
-  case COLORCODE_GREY: return "\033[22;37m";
-  case COLORCODE_GREEN: return "\033[01;32m";
-  case COLORCODE_RED: return "\033[01;31m";
-  case COLORCODE_YELLOW: return "\033[01;33m";
-  default: return "";
-  }
-}
+#if defined(MICROUNIT_FREESTANDING) && !defined(MICROUNIT_LEAN)
+#define MICROUNIT_API inline
+#else
+#define MICROUNIT_API
+#endif
 
 /**
-* @brief Helper function to change the current terminal color.
-* @param [in] color_code Input color code.
+* @brief Defined in the translation units that compile the runner, and only
+*        there, so that test files see neither its code nor the system
+*        headers it needs.
 */
-inline void SetTerminalColor(int color_code) {
-#if defined(_WIN32)
-  HANDLE handler = GetStdHandle(STD_OUTPUT_HANDLE);
-  CONSOLE_SCREEN_BUFFER_INFO buffer_info;
-  GetConsoleScreenBufferInfo(handler, &buffer_info);
-  SetConsoleTextAttribute(handler, ((buffer_info.wAttributes & 0xFFF0) |
-    (WORD)color_code));
-#else
-  std::cout << ColorCodeToANSI(color_code);
+#if defined(MICROUNIT_IMPLEMENTATION) || defined(MICROUNIT_MODULE_INTERFACE) \
+    || (defined(MICROUNIT_FREESTANDING) && !defined(MICROUNIT_LEAN))
+#define MICROUNIT_RUNNER
 #endif
-}
 
 /**
-* @brief Helper class to be used as a iostream manipulator and change the
-*        terminal color.
+* @brief Defined when the library writes through std::cout and can log any
+*        value with an std::ostream operator<<. MICROUNIT_LEAN and module
+*        builds write to the standard output file descriptor instead, which
+*        keeps <iostream> out of them.
 */
-class Color {
-public:
-  Color(int code) : code_(code) {}
-  void Set() const {
-    SetTerminalColor(code_);
-  }
-  int code() const { return code_; }
-private:
-  int code_;
-};
-
-const static Color Grey{ COLORCODE_GREY };
-const static Color Green{ COLORCODE_GREEN };
-const static Color Red{ COLORCODE_RED };
-const static Color Yellow{ COLORCODE_YELLOW };
+#if !defined(MICROUNIT_LEAN) && !defined(MICROUNIT_MODULE_INTERFACE) &&     \
+    !defined(MICROUNIT_FREESTANDING)
+#define MICROUNIT_STREAMS
+#endif
 
 /**
-* @brief Helper class to be used in a cout streaming statement. Resets to
-*        the default terminal color upon statement completion.
+* @brief Capacity of the registry in MICROUNIT_FREESTANDING mode.
 */
-class SaveColor {
-public:
-  ~SaveColor() {
-    SetTerminalColor(Grey.code());
-  };
-};
+#if !defined(MICROUNIT_MAX_UNITS)
+#define MICROUNIT_MAX_UNITS 256
+#endif
+#if !defined(MICROUNIT_MAX_TEARDOWNS)
+#define MICROUNIT_MAX_TEARDOWNS 16
+#endif
 
 /**
-* @brief Helper class to be used in a cout streaming statement. Puts a line
-*        break upon statement completion.
+* @brief Maximum number of listeners registered at the same time.
 */
-class EndingLineBreak {
-public:
-  ~EndingLineBreak() {
-    std::cout << std::endl;
-  };
-};
-}
-
-/** @brief Operator to allow using SaveColor class with an ostream */
-inline std::ostream& operator<<(std::ostream& os,
-                                const microunit::SaveColor& obj) {
-  return os;
-}
-
-/** @brief Operator to allow using EndingLineBreak class with an ostream */
-inline std::ostream& operator<<(std::ostream& os,
-                                const microunit::EndingLineBreak& obj) {
-  return os;
-}
+#if !defined(MICROUNIT_MAX_LISTENERS)
+#define MICROUNIT_MAX_LISTENERS 8
+#endif
 
-/** @brief Operator to allow using Color class with an ostream */
-inline std::ostream& operator<<(std::ostream& os,
-                                const microunit::Color& color) {
-  color.Set();
-  return os;
-}
+/**
+* @brief Helper macros to get current logging filename. The directories are
+*        stripped at compile time, by the compiler itself when it provides
+*        __FILE_NAME__, or by a constexpr scan of __FILE__ otherwise.
+*/
+#if defined(__FILE_NAME__)
+#define __FILENAME__ __FILE_NAME__
+#else
+#define __FILENAME__ (__FILE__ + microunit::SizeConstant<                       \
+  microunit::BasenameOffset(__FILE__)>::value)
+#endif
+#define MICROUNIT_SEPARATOR "----------------------------------------"         \
+                            "----------------------------------------"
 
 /**
 * @brief Macro for writing to the terminal an INFO-level log
 */
-#define TERMINAL_INFO std::cout << microunit::SaveColor{} <<                   \
-microunit::EndingLineBreak{} << microunit::Yellow << "[    ] "
+#define TERMINAL_INFO microunit::LogLine(microunit::COLORCODE_YELLOW)
 #define LOG_INFO TERMINAL_INFO << __FILENAME__ << ":" << __LINE__ << ": "
 
 /**
 * @brief Macro for writing to the terminal a BAD-level log
 */
-#define TERMINAL_BAD std::cout << microunit::SaveColor{} <<                    \
-microunit::EndingLineBreak{} << microunit::Red << "[    ] "
+#define TERMINAL_BAD microunit::LogLine(microunit::COLORCODE_RED)
 #define LOG_BAD TERMINAL_BAD << __FILENAME__ << ":" << __LINE__ << ": "
 
 /**
 * @brief Macro for writing to the terminal a GOOD-level log
 */
-#define TERMINAL_GOOD std::cout << microunit::SaveColor{} <<                   \
-microunit::EndingLineBreak{} << microunit::Green << "[    ] "
+#define TERMINAL_GOOD microunit::LogLine(microunit::COLORCODE_GREEN)
 #define LOG_GOOD TERMINAL_GOOD << __FILENAME__ << ":" << __LINE__ << ": "
 
-namespace microunit {
-/**
-* @brief Result of a unit test.
-*/
-struct UnitFunctionResult {
-  bool success{ true };
-};
-
-/**
-* @brief Unit test function type.
-*/
-typedef void(*UnitFunction)(UnitFunctionResult*);
-
 /**
-* @brief Main class for unit test management. This class is a singleton
-*        and maintains a list of all registered unit test cases.
+* @brief Give a type a fixed name in typed test case names (see TypeName).
+*        Must be used inside namespace microunit.
 */
-class UnitTester {
-public:
-  /**
-  * @brief Run all the registered unit test cases.
-  * @returns True if all tests pass, false otherwise.
-  */
-  static bool Run() {
-    std::vector<std::string> failures, sucesses;
-
-    TERMINAL_INFO
-      << "Will run " << Instance().unitfunction_map_.size() 
-      << " test cases";
-
-    // Iterate all registered unit tests
-    for (auto& unit : Instance().unitfunction_map_) {
-      std::cout << MICROUNIT_SEPARATOR << std::endl;
-      TERMINAL_GOOD << "Test case '" << unit.first << "'";
-
-      // Run the unit test
-      UnitFunctionResult result;
-      unit.second(&result);
-
-      if (!result.success) {
-        TERMINAL_BAD << "Failed test";
-        failures.push_back(unit.first);
-      } else {
-        TERMINAL_GOOD << "Passed test";
-        sucesses.push_back(unit.first);
-      }
-    }
-    std::cout
-      << MICROUNIT_SEPARATOR << std::endl
-      << MICROUNIT_SEPARATOR << std::endl;
-
-    TERMINAL_GOOD << "Passed " << sucesses.size()
-      << " test cases:";
-    for (const auto& success_t : sucesses) {
-      TERMINAL_GOOD << success_t;
-    }
-    std::cout << MICROUNIT_SEPARATOR << std::endl;
-
-    // Output result summary
-    if (failures.empty()) {
-      TERMINAL_GOOD << "All tests passed";
-      std::cout << MICROUNIT_SEPARATOR << std::endl;
-      return true;
-    } else {
-      TERMINAL_BAD << "Failed " << failures.size()
-        << " test cases:";
-      for (const auto& failure : failures) {
-        TERMINAL_BAD << failure;
-      }
-      std::cout << MICROUNIT_SEPARATOR << std::endl;
-      return false;
-    }
-  }
-
-  /**
-  * @brief Register a unit test case function. In regular library client usage,
-  *        this doesn't need to be called, and the macro UNIT should be used
-  *        instead.
-  * @param [in] name  Name of the unit test case.
-  * @param [in] function  Pointer to unit test case function.
-  * @returns True if all tests pass, false otherwise.
-  */
-  static void RegisterFunction(const std::string &name,
-                               UnitFunction function) {
-    Instance().unitfunction_map_.emplace(name, function);
-  }
-
-  /**
-  * @brief Helper class to register a unit test in construction time. This is
-  *        used to call RegisterFunction in the construction of a static
-  *        helper object. Used by the REGISTER_UNIT macro, which in turn is
-  *        used by the UNIT macro.
-  * @returns True if all tests pass, false otherwise.
-  */
-  class Registrator {
-  public:
-    Registrator(const std::string &name,
-                UnitFunction function) {
-      UnitTester::RegisterFunction(name, function);
-    };
-    Registrator(const Registrator&) = delete;
-    Registrator(Registrator&&) = delete;
-    ~Registrator() {};
-  };
-
-  ~UnitTester() {};
-  UnitTester(const UnitTester&) = delete;
-  UnitTester(UnitTester&&) = delete;
-
-private:
-  UnitTester() {};
-  static UnitTester& Instance() {
-    static UnitTester instance;
-    return instance;
-  }
-  std::map<std::string, UnitFunction> unitfunction_map_;
+#define MICROUNIT_TYPE_NAME(TYPE)                                              \
+template <> struct TypeName<TYPE> {                                            \
+  static const char* Get() { return #TYPE; }                                   \
 };
-}
 
 #define MACROCAT_NEXP(A, B) A ## B
 #define MACROCAT(A, B) MACROCAT_NEXP(A, B)
@@ -343,39 +236,4677 @@ void FUNCTION(microunit::UnitFunctionResult*);                                 \
 REGISTER_UNIT(FUNCTION);                                                       \
 void FUNCTION(microunit::UnitFunctionResult *__microunit_testresult)
 
+/**
+* @brief Define a unit function body that uses a per-test fixture. A fresh
+*        FIXTURE (or a recycled one, if FIXTURE has a Reset() method) is
+*        available in the body as 'fixture'.
+* @code{.cpp}
+*  UNIT_F(Stack, Test_Push) {
+*    fixture.Push(1);
+*    ASSERT_TRUE(fixture.Size() == 1);
+*  };
+* @endcode
+*/
+#define UNIT_F(FIXTURE, FUNCTION)                                              \
+void FUNCTION(microunit::UnitFunctionResult*, FIXTURE&);                       \
+static void MACROCAT(FUNCTION, _MicrounitFixture)(                             \
+    microunit::UnitFunctionResult *result) {                                   \
+  microunit::PerTestFixture<FIXTURE>::Run(result, FUNCTION);                   \
+}                                                                              \
+static microunit::UnitTester::Registrator                                      \
+MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__)(                                 \
+    #FUNCTION, MACROCAT(FUNCTION, _MicrounitFixture));                         \
+void FUNCTION(microunit::UnitFunctionResult *__microunit_testresult,           \
+              FIXTURE& fixture)
+
+/**
+* @brief Define a unit function body that uses a suite-level fixture. The
+*        FIXTURE is built once, on first use, and shared read-only by every
+*        test case that declares it. It is available as 'fixture'.
+* @code{.cpp}
+*  UNIT_SHARED(LargeIndex, Test_Lookup) {
+*    ASSERT_TRUE(fixture.Find("key") != nullptr);
+*  };
+* @endcode
+*/
+#define UNIT_SHARED(FIXTURE, FUNCTION)                                         \
+void FUNCTION(microunit::UnitFunctionResult*, const FIXTURE&);                 \
+static void MACROCAT(FUNCTION, _MicrounitFixture)(                             \
+    microunit::UnitFunctionResult *result) {                                   \
+  microunit::SharedFixture<FIXTURE>::Run(result, FUNCTION);                    \
+}                                                                              \
+static microunit::SharedFixture<FIXTURE>::User                                 \
+MACROCAT(MICROUNIT_FIXTURE_USER, __COUNTER__);                                 \
+static microunit::UnitTester::Registrator                                      \
+MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__)(                                 \
+    #FUNCTION, MACROCAT(FUNCTION, _MicrounitFixture));                         \
+void FUNCTION(microunit::UnitFunctionResult *__microunit_testresult,           \
+              const FIXTURE& fixture)
+
+/**
+* @brief Define a test case body as a lambda with the given captures, to be
+*        registered at run time with UnitTester::RegisterCallable.
+* @code{.cpp}
+*  for (const std::string& path : corpus) {
+*    microunit::UnitTester::RegisterCallable(("Parse_" + path).c_str(),
+*      UNIT_LAMBDA(path) {
+*        ASSERT_TRUE(Parse(path));
+*      });
+*  }
+* @endcode
+*/
+#define UNIT_LAMBDA(...)                                                       \
+[__VA_ARGS__](microunit::UnitFunctionResult *__microunit_testresult)
+
+/**
+* @brief Define a unit function body that runs once per parameter of a lazy
+*        generator (see Range, Values, Cartesian and Zip). The parameter is
+*        available as 'param', and a single one can be selected to rerun it
+*        with the filter "FUNCTION[index]".
+* @code{.cpp}
+*  PARAM_UNIT(Test_Add, microunit::Cartesian(microunit::Range(0, 1000),
+*                                            microunit::Range(0, 10000))) {
+*    ASSERT_TRUE(Add(std::get<0>(param), std::get<1>(param)) >= 0);
+*  };
+* @endcode
+*/
+#define PARAM_UNIT(FUNCTION, ...)                                              \
+static auto MACROCAT(FUNCTION, _MicrounitParameters)()                         \
+  -> decltype(__VA_ARGS__) {                                                   \
+  return __VA_ARGS__;                                                          \
+}                                                                              \
+typedef decltype(MACROCAT(FUNCTION, _MicrounitParameters)().At(0))             \
+  MACROCAT(FUNCTION, _MicrounitParameter);                                     \
+void FUNCTION(microunit::UnitFunctionResult*,                                  \
+              const MACROCAT(FUNCTION, _MicrounitParameter)&);                 \
+static microunit::UnitTester::ParameterizedRegistrator                         \
+MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__)(                                 \
+    #FUNCTION, MACROCAT(FUNCTION, _MicrounitParameters)(), FUNCTION);          \
+void FUNCTION(microunit::UnitFunctionResult *__microunit_testresult,           \
+              const MACROCAT(FUNCTION, _MicrounitParameter)& param)
+
+/**
+* @brief Set the resource limits of a test case in isolated mode (see
+*        RunOptions::isolate). The body adjusts 'limits', which start as
+*        RunOptions::limits.
+* @code{.cpp}
+*  UNIT_LIMITS(Test_Sort_Large) {
+*    limits.cpu_seconds = 30;
+*    limits.address_space = size_t(4) << 30;
+*  }
+* @endcode
+*/
+#define UNIT_LIMITS(FUNCTION)                                                  \
+static void MACROCAT(FUNCTION, _MicrounitLimits)(microunit::ResourceLimits&);  \
+static microunit::UnitTester::LimitsRegistrator                                \
+MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__)(                                 \
+    #FUNCTION, MACROCAT(FUNCTION, _MicrounitLimits));                          \
+static void MACROCAT(FUNCTION, _MicrounitLimits)(                              \
+    microunit::ResourceLimits& limits)
+
+/**
+* @brief Give a test case comma separated tags, by which RunOptions::tags
+*        and SelfTestOptions::tags select test cases.
+* @code{.cpp}
+*  UNIT_TAGS(Test_Dot_Avx2, "simd,startup");
+* @endcode
+*/
+#define UNIT_TAGS(FUNCTION, TAGS)                                              \
+static microunit::UnitTester::TagsRegistrator                                  \
+MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__)(#FUNCTION, TAGS)
+
+/**
+* @brief Define a unit function body that is instantiated for every type in a
+*        type list. Each instance is registered as a separate test case named
+*        FUNCTION<type>, in which the type is available as 'TypeParam'. The
+*        types can be given directly or as a microunit::Types list. Aliases
+*        of the same type, like int and int32_t, give the same name; the run
+*        reports the duplicate as a failure.
+* @code{.cpp}
+*  TYPED_UNIT(Test_Abs, int8_t, int32_t, double) {
+*    ASSERT_TRUE(std::abs(TypeParam(-1)) == TypeParam(1));
+*  };
+* @endcode
+*/
+#define TYPED_UNIT(FUNCTION, ...)                                              \
+template <typename TypeParam>                                                  \
+struct MACROCAT(FUNCTION, _MicrounitTyped) {                                   \
+  static void Run(microunit::UnitFunctionResult*);                             \
+};                                                                             \
+static const int MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__) =               \
+  (microunit::RegisterTyped<MACROCAT(FUNCTION, _MicrounitTyped)>(              \
+    #FUNCTION, microunit::MakeTypes<__VA_ARGS__>::type()), 0);                 \
+template <typename TypeParam>                                                  \
+void MACROCAT(FUNCTION, _MicrounitTyped)<TypeParam>::Run(                      \
+    microunit::UnitFunctionResult *__microunit_testresult)
+
+#if MICROUNIT_CPLUSPLUS >= 201402L
+/**
+* @brief Define a unit function body that is checked at compile time. The body
+*        is constexpr and evaluated in a static_assert, so a failing
+*        STATIC_ASSERT_TRUE/STATIC_ASSERT_FALSE is a compile error pointing at
+*        the assertion. The same body is also registered as a regular test
+*        case, so it is executed and reported by UnitTester::Run. Only the
+*        STATIC_ASSERT_* macros can be used in the body. Requires C++14.
+* @code{.cpp}
+*  STATIC_UNIT(Test_Constexpr_Square) {
+*    STATIC_ASSERT_TRUE(Square(3) == 9);
+*  };
+* @endcode
+*/
+#define STATIC_UNIT(FUNCTION)                                                  \
+constexpr void FUNCTION(microunit::StaticUnitResult&);                         \
+template <typename = void>                                                     \
+struct MACROCAT(FUNCTION, _MicrounitStatic) {                                  \
+  static constexpr bool Evaluate() {                                           \
+    microunit::StaticUnitResult result{};                                      \
+    FUNCTION(result);                                                          \
+    return result.success;                                                     \
+  }                                                                            \
+  static void Run(microunit::UnitFunctionResult *result) {                     \
+    static_assert(Evaluate(), "STATIC_UNIT " #FUNCTION " failed");             \
+    microunit::StaticUnitResult static_result{};                               \
+    FUNCTION(static_result);                                                   \
+    result->success = static_result.success;                                   \
+  }                                                                            \
+};                                                                             \
+static microunit::UnitTester::Registrator                                      \
+MACROCAT(MICROUNIT_REGISTRATION, __COUNTER__)(                                 \
+    #FUNCTION, &MACROCAT(FUNCTION, _MicrounitStatic)<>::Run);                  \
+constexpr void FUNCTION(microunit::StaticUnitResult &__microunit_staticresult)
+
+/**
+* @brief Check a condition in a STATIC_UNIT body. If the condition does not
+*        hold, compilation fails; at run time, the test fails and returns.
+*/
+#define STATIC_ASSERT_TRUE(condition) if(!(condition)) {                       \
+microunit::StaticUnitAssertionFailed(__microunit_staticresult, __FILENAME__,   \
+  __LINE__, "Static-assert-true failed: " #condition);                         \
+return;                                                                        \
+}
+
+/**
+* @brief Check a condition in a STATIC_UNIT body. If the condition holds,
+*        compilation fails; at run time, the test fails and returns.
+*/
+#define STATIC_ASSERT_FALSE(condition) if((condition)) {                       \
+microunit::StaticUnitAssertionFailed(__microunit_staticresult, __FILENAME__,   \
+  __LINE__, "Static-assert-false failed: " #condition);                        \
+return;                                                                        \
+}
+#endif
+
 /**
 * @brief Pass the test and return from the test case.
 */
 #define PASS() {                                                               \
-LOG_GOOD << "Test stopped: Pass";                                              \
-__microunit_testresult->success = true;                                        \
+static constexpr microunit::SourceLocation __microunit_location{               \
+  __FILENAME__, __LINE__, nullptr };                                           \
+microunit::ReportPass(__microunit_location, __microunit_testresult);           \
 return;                                                                        \
 }
 
 /**
 * @brief Fail the test and return from the test case.
 */
-#define FAIL() {                                                               \
-LOG_BAD << "Test stopped: Fail";                                               \
-__microunit_testresult->success = false;                                       \
-return;                                                                        \
-}
+#define FAIL() MICROUNIT_FAIL_WITH(nullptr)
 
 /**
 * @brief Check a particular test condition. If the condition does not hold,
 *        fail the test and return.
 */
-#define ASSERT_TRUE(condition) if(!(condition)) {                              \
-LOG_BAD << "Assert-true failed: " #condition;                                  \
-FAIL();                                                                        \
-}
+#define ASSERT_TRUE(condition) if(MICROUNIT_UNLIKELY(!(condition)))            \
+MICROUNIT_FAIL_WITH("Assert-true failed: " #condition)
 
 /**
 * @brief Check a particular test condition. If the condition holds, fail the
 *        test and return.
 */
-#define ASSERT_FALSE(condition) if((condition)) {                              \
-LOG_BAD << "Assert-false failed: " #condition << std::endl;                    \
-FAIL();                                                                        \
-}
+#define ASSERT_FALSE(condition) if(MICROUNIT_UNLIKELY(!!(condition)))          \
+MICROUNIT_FAIL_WITH("Assert-false failed: " #condition)
+
+/**
+* @brief Check that a counter of an IoMeter (a member of IoCounters, such as
+*        write_syscalls) is at most LIMIT. Otherwise fail the test and return.
+* @code{.cpp}
+*  UNIT(Test_Batched_Writes) {
+*    microunit::IoMeter io;
+*    WriteRecords(file, 1000);
+*    ASSERT_IO_AT_MOST(io, write_syscalls, 1);
+*  };
+* @endcode
+*/
+#define ASSERT_IO_AT_MOST(meter, counter, limit)                               \
+if(MICROUNIT_UNLIKELY((meter).Counters().counter > (limit)))                   \
+MICROUNIT_FAIL_WITH("Assert-io failed: " #counter " <= " #limit)
+
+/**
+* @brief Check that the test case has used at most LIMIT bytes of stack so
+*        far (see StackHighWater). Otherwise fail the test and return.
+*/
+#define ASSERT_STACK_AT_MOST(limit)                                            \
+if(MICROUNIT_UNLIKELY(microunit::StackHighWater() > (limit)))                  \
+MICROUNIT_FAIL_WITH("Assert-stack failed: stack <= " #limit)
+
+/**
+* @brief Fail the test with the given message and return. The location is a
+*        constant, so the only code emitted at the call site is a call to the
+*        out-of-line ReportFailure.
+*/
+#define MICROUNIT_FAIL_WITH(message) {                                         \
+static constexpr microunit::SourceLocation __microunit_location{               \
+  __FILENAME__, __LINE__, message };                                           \
+microunit::ReportFailure(__microunit_location, __microunit_testresult);        \
+return;                                                                        \
+}
+
+#if !defined(MICROUNIT_MACROS_ONLY)
+// Keep in sync with the global module fragment of microunit.cppm.
+#if (!defined(MICROUNIT_LEAN) || defined(MICROUNIT_IMPLEMENTATION)) &&        \
+    !defined(MICROUNIT_FREESTANDING)
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+// In C++20, libstdc++'s <chrono> includes <sstream>, and GCC then emits the
+// stream vtables in every file that imports the module, which fails to link.
+// <thread> already declares the clocks and durations used here.
+#if !defined(MICROUNIT_MODULE_INTERFACE) || !defined(__GLIBCXX__)
+#include <chrono>
+#endif
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#if defined(MICROUNIT_STREAMS)
+#include <sstream>
+#include <iostream>
+#endif
+#if MICROUNIT_CPLUSPLUS >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#define MICROUNIT_HAS_PMR
+#include <memory_resource>
+#endif
+#endif
+#endif
+// The runner only: the test files see none of the system headers.
+#if defined(MICROUNIT_RUNNER) && !defined(MICROUNIT_FREESTANDING)
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include "windows.h"
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define MICROUNIT_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define MICROUNIT_ASAN
+#endif
+#endif
+#if defined(MICROUNIT_ASAN)
+#include <sanitizer/asan_interface.h>
+#endif
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#if defined(PTRACE_GET_SYSCALL_INFO)
+#define MICROUNIT_HAS_SYSCALL_TRACE
+#endif
+#if !defined(MICROUNIT_FREESTANDING)
+#include <new>
+#endif
+
+namespace microunit {
+/** @brief Compile-time size constant, see __FILENAME__. */
+template <size_t Value>
+struct SizeConstant {
+  static constexpr size_t value = Value;
+};
+
+/** @brief Whether a character separates directories in a source path. */
+constexpr bool IsPathSeparator(char c) {
+#if defined(_WIN32)
+  return c == '/' || c == '\\';
+#else
+  return c == '/';
+#endif
+}
+
+/**
+* @brief Offset of the file name within a source file path. Meant to be
+*        evaluated at compile time (see __FILENAME__).
+*/
+#if MICROUNIT_CPLUSPLUS >= 201402L
+constexpr size_t BasenameOffset(const char *path) {
+  size_t offset = 0;
+  for (size_t i = 0; path[i] != '\0'; ++i) {
+    if (IsPathSeparator(path[i])) offset = i + 1;
+  }
+  return offset;
+}
+#else
+constexpr size_t BasenameOffset(const char *path, size_t i = 0,
+                                size_t offset = 0) {
+  return path[i] == '\0' ? offset :
+    BasenameOffset(path, i + 1, IsPathSeparator(path[i]) ? i + 1 : offset);
+}
+#endif
+}
+
+namespace microunit {
+enum ColorCode : int {
+  COLORCODE_GREY = 7,
+  COLORCODE_GREEN = 10,
+  COLORCODE_RED = 12,
+  COLORCODE_YELLOW = 14
+};
+
+/**
+* @brief Helper function to convert from color codes to ansi escape codes.
+*        Used to print color in non-win32 systems.
+*/
+inline const char* AnsiColorCode(const int color_code) {
+  switch (color_code) {
+  case COLORCODE_GREY: return "\033[22;37m";
+  case COLORCODE_GREEN: return "\033[01;32m";
+  case COLORCODE_RED: return "\033[01;31m";
+  case COLORCODE_YELLOW: return "\033[01;33m";
+  default: return "";
+  }
+}
+
+/**
+* @brief Write raw text to the test output.
+*/
+MICROUNIT_API void WriteOutput(const char *data, size_t size);
+
+/** @brief Write a full line of raw text to the test output. */
+inline void WriteLine(const char *text) {
+  WriteOutput(text, strlen(text));
+  WriteOutput("\n", 1);
+}
+
+#if defined(MICROUNIT_FREESTANDING)
+/**
+* @brief Output function of MICROUNIT_FREESTANDING mode, called for every
+*        character of the test output (e.g., a UART putc).
+*/
+typedef void(*OutputSink)(char c);
+
+/**
+* @brief Set the function that receives the test output. Until it is set,
+*        the output is discarded.
+*/
+MICROUNIT_API void SetOutputSink(OutputSink sink);
+#else
+/**
+* @brief Private scratch directory of the running test case, created on the
+*        first call, under RunOptions::scratch_root. It is removed when the
+*        test case passes and kept when it fails. Null on Windows, or if it
+*        cannot be created.
+* @code{.cpp}
+*  UNIT(Test_Save) {
+*    const std::string path = std::string(microunit::ScratchDirectory()) +
+*      "/settings.ini";
+*    ASSERT_TRUE(Save(path) && Load(path));
+*  };
+* @endcode
+*/
+MICROUNIT_API const char* ScratchDirectory();
+
+/**
+* @brief Seed for the randomness of the running test case (e.g. for
+*        FaultyFileIo). It depends only on the name of the test case (and
+*        parameter index) and RunOptions::seed, so that a failure can be
+*        reproduced by running it again.
+*/
+MICROUNIT_API uint64_t TestSeed();
+
+/**
+* @brief Add bytes of the state of the running test case to the digest that
+*        RunOptions::check_determinism compares between its two runs. The
+*        bytes must not include padding. Does nothing in other runs.
+* @code{.cpp}
+*  UNIT(Test_Schedule) {
+*    const std::vector<int> order = Schedule(jobs);
+*    microunit::RecordState(order.data(), order.size() * sizeof(int));
+*    ASSERT_TRUE(order.size() == jobs.size());
+*  };
+* @endcode
+*/
+MICROUNIT_API void RecordState(const void *data, size_t size);
+
+/**
+* @brief Most bytes of stack that the running test case has used so far,
+*        when it runs on a painted stack (see RunOptions::stack_size), and 0
+*        otherwise.
+*/
+MICROUNIT_API size_t StackHighWater();
+
+/** @brief Receiver of the output of a self-test (see SelfTest). */
+typedef void(*OutputCallback)(const char *data, size_t size, void *context);
+
+/**
+* @brief Options of a self-test, see SelfTest::Start.
+*/
+struct SelfTestOptions {
+  /** @brief Comma separated tags of the test cases to run (see UNIT_TAGS). */
+  const char *tags{ nullptr };
+  /**
+  * @brief Thread CPU time, in seconds, after which no more test cases are
+  *        started, or 0 for no budget.
+  */
+  double cpu_budget{ 0 };
+  /** @brief Receiver of the output, without colors, or null to drop it. */
+  OutputCallback output{ nullptr };
+  void *context{ nullptr };
+};
+
+/** @brief Progress and results of a self-test, see SelfTest::Status. */
+struct SelfTestStatus {
+  bool started;
+  bool finished;
+  /** @brief Whether every selected test case ran, within the budget. */
+  bool complete;
+  size_t test_count;
+  size_t passed;
+  size_t failed;
+};
+
+/**
+* @brief Built-in self-test of a production binary: runs the tagged test
+*        cases linked into it on a background thread at the lowest priority,
+*        so that startup does not wait for them. It must not run at the same
+*        time as UnitTester::Run.
+* @code{.cpp}
+*  microunit::SelfTestOptions options;
+*  options.tags = "startup";
+*  options.cpu_budget = 2;
+*  options.output = [](const char *data, size_t size, void*) {
+*    Log(std::string(data, size));
+*  };
+*  microunit::SelfTest::Start(options);
+*  // ... later, e.g. in a health check:
+*  if (microunit::SelfTest::Status().failed) ReportUnhealthy();
+* @endcode
+*/
+class SelfTest {
+public:
+  /** @brief Start the self-test, unless one was already started. */
+  MICROUNIT_API static bool Start(const SelfTestOptions& options);
+
+  /** @brief Current progress and results. */
+  MICROUNIT_API static SelfTestStatus Status();
+
+  /** @brief Call a function with the name of each failed test case. */
+  MICROUNIT_API static void ForEachFailure(
+    void(*visit)(const char *name, void *context), void *context);
+
+  /** @brief Wait until the self-test finishes. */
+  MICROUNIT_API static void Wait();
+
+  /**
+  * @brief Start no more test cases, and wait until the running one ends.
+  *        Also done at exit.
+  */
+  MICROUNIT_API static void Cancel();
+};
+
+/**
+* @brief I/O counters of this process, from /proc/self/io and
+*        /proc/self/status. They are zero on systems without them.
+*/
+struct IoCounters {
+  /** @brief Bytes passed to read-like and write-like syscalls. */
+  uint64_t read_bytes{ 0 };
+  uint64_t write_bytes{ 0 };
+  /** @brief Read-like and write-like syscalls. */
+  uint64_t read_syscalls{ 0 };
+  uint64_t write_syscalls{ 0 };
+  /** @brief Bytes actually fetched from and sent to storage. */
+  uint64_t storage_read_bytes{ 0 };
+  uint64_t storage_write_bytes{ 0 };
+  /** @brief Voluntary (blocking) and involuntary context switches. */
+  uint64_t voluntary_switches{ 0 };
+  uint64_t involuntary_switches{ 0 };
+};
+
+/**
+* @brief Measures the I/O of the process from its construction, for use
+*        with ASSERT_IO_AT_MOST. The counters cover all the threads, and the
+*        test output written meanwhile, but not the reads of the counters.
+*/
+class IoMeter {
+public:
+  MICROUNIT_API IoMeter();
+  /** @brief Counters since construction. */
+  MICROUNIT_API IoCounters Counters();
+
+private:
+  IoCounters start_;
+  uint64_t own_syscalls_{ 0 };
+  uint64_t own_bytes_{ 0 };
+};
+#endif
+
+class Color;
+
+/**
+* @brief One line of terminal log, built with operator<< and written at once,
+*        in color and with a line break, when the object is destroyed at the
+*        end of the logging statement. Used by the TERMINAL_* and LOG_*
+*        macros. In the default mode, anything that can be written to an
+*        std::ostream can be logged, and stream manipulators (std::endl,
+*        std::hex, std::setw...) apply to the rest of the line; in
+*        MICROUNIT_LEAN mode and through the module, only strings,
+*        characters, numbers and pointers.
+*/
+class LogLine {
+public:
+  MICROUNIT_API explicit LogLine(int color_code);
+  MICROUNIT_API ~LogLine();
+  LogLine(const LogLine&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+
+  MICROUNIT_API LogLine& operator<<(const char *value);
+  MICROUNIT_API LogLine& operator<<(char value);
+  MICROUNIT_API LogLine& operator<<(bool value);
+  MICROUNIT_API LogLine& operator<<(long long value);
+  MICROUNIT_API LogLine& operator<<(unsigned long long value);
+  MICROUNIT_API LogLine& operator<<(double value);
+  MICROUNIT_API LogLine& operator<<(const void *value);
+  LogLine& operator<<(signed char value) {
+    return *this << static_cast<char>(value);
+  }
+  LogLine& operator<<(unsigned char value) {
+    return *this << static_cast<char>(value);
+  }
+  LogLine& operator<<(short value) {
+    return *this << static_cast<long long>(value);
+  }
+  LogLine& operator<<(unsigned short value) {
+    return *this << static_cast<unsigned long long>(value);
+  }
+  LogLine& operator<<(int value) {
+    return *this << static_cast<long long>(value);
+  }
+  LogLine& operator<<(unsigned int value) {
+    return *this << static_cast<unsigned long long>(value);
+  }
+  LogLine& operator<<(long value) {
+    return *this << static_cast<long long>(value);
+  }
+  LogLine& operator<<(unsigned long value) {
+    return *this << static_cast<unsigned long long>(value);
+  }
+  LogLine& operator<<(float value) {
+    return *this << static_cast<double>(value);
+  }
+#if !defined(MICROUNIT_LEAN) && !defined(MICROUNIT_FREESTANDING)
+  MICROUNIT_API LogLine& operator<<(const Color& color);
+#endif
+#if defined(MICROUNIT_STREAMS)
+  template <typename T>
+  LogLine& operator<<(const T& value);
+  LogLine& operator<<(std::ostream& (*manipulator)(std::ostream&));
+  LogLine& operator<<(std::ios_base& (*manipulator)(std::ios_base&));
+#endif
+
+private:
+  MICROUNIT_API void Append(const char *data, size_t size);
+  MICROUNIT_API void Flush();
+
+  // Write a value to the stream of the line, if it has one, so that the
+  // manipulators logged before it apply.
+  template <typename T>
+  bool Streamed(const T& value) {
+#if defined(MICROUNIT_STREAMS)
+    if (stream_) {
+      *stream_ << value;
+      return true;
+    }
+#endif
+    (void)value;
+    return false;
+  }
+
+#if defined(MICROUNIT_STREAMS)
+  std::ostream& Stream();
+  void Drain();
+
+  // The rest of the line, once a value without a built-in overload or a
+  // manipulator has been logged.
+  std::unique_ptr<std::ostringstream> stream_;
+#endif
+  int color_code_;
+  size_t size_{ 0 };
+  char buffer_[256];
+};
+
+/**
+* @brief Result of a unit test.
+*/
+struct UnitFunctionResult {
+  bool success{ true };
+};
+
+/**
+* @brief Unit test function type.
+*/
+typedef void(*UnitFunction)(UnitFunctionResult*);
+
+/**
+* @brief Options for the per-test arena allocator (see ArenaResource).
+*/
+struct ArenaOptions {
+  /** @brief Size of each block requested from the system. */
+  size_t chunk_size{ size_t(2) << 20 };
+  /** @brief Back the arena with huge pages, where the system has them. */
+  bool huge_pages{ false };
+  /** @brief Fill released memory with a pattern (and mark it as poisoned
+  *          under AddressSanitizer) to catch uses after the test. */
+  bool poison{ false };
+  /** @brief Report test cases that leave arena allocations unreleased. */
+  bool report_leaks{ false };
+};
+
+/**
+* @brief Resource limits of a test case in isolated mode, set with setrlimit
+*        in the child process. Zero means no limit.
+*/
+struct ResourceLimits {
+  /** @brief CPU time, in seconds. */
+  unsigned cpu_seconds{ 0 };
+  /**
+  * @brief Address space, in bytes. A test case that fails, or does not
+  *        catch the std::bad_alloc, after an allocation failed is reported
+  *        as over the limit. Not usable with AddressSanitizer.
+  */
+  size_t address_space{ 0 };
+  /** @brief Open file descriptors, including the standard ones. */
+  size_t open_files{ 0 };
+  /** @brief Bytes of output, and size of any file the test case writes. */
+  size_t output_bytes{ 0 };
+};
+
+/**
+* @brief Options that control a run of the registered test cases.
+*/
+struct RunOptions {
+  /** @brief Give each test case a bump allocator, see TestArena(). */
+  bool arena{ false };
+  ArenaOptions arena_options;
+  /**
+  * @brief Comma separated names of the test cases to run, or all of them
+  *        if null. A trailing '*' matches any suffix, and a trailing [index]
+  *        selects one parameter of a PARAM_UNIT. Ignored in
+  *        MICROUNIT_FREESTANDING mode.
+  */
+  const char *filter{ nullptr };
+  /**
+  * @brief Path of a journal where the result of each test case is appended
+  *        as soon as it completes, or null. Ignored in MICROUNIT_FREESTANDING
+  *        mode.
+  */
+  const char *journal{ nullptr };
+  /**
+  * @brief Skip the test cases already in the journal and report their
+  *        recorded results, instead of starting a new journal.
+  */
+  bool resume{ false };
+  /**
+  * @brief Stop on SIGINT and SIGTERM after the test case that is running,
+  *        and still write the journal and the summary. A second signal
+  *        terminates the process right away. Ignored in
+  *        MICROUNIT_FREESTANDING mode.
+  */
+  bool handle_signals{ false };
+  /**
+  * @brief Run each test case in a child process, so that a crash or a
+  *        resource limit only fails that test case. Its output goes through
+  *        the runner, and its failure events reach the listeners of the
+  *        child. Ignored on Windows and in MICROUNIT_FREESTANDING mode.
+  */
+  bool isolate{ false };
+  /** @brief Default resource limits in isolated mode, see UNIT_LIMITS. */
+  ResourceLimits limits;
+  /**
+  * @brief Directory where ScratchDirectory() creates the directories of the
+  *        test cases, or null for /dev/shm when it is writable, and $TMPDIR
+  *        or /tmp otherwise.
+  */
+  const char *scratch_root{ nullptr };
+  /**
+  * @brief Bytes that the files in a scratch directory may add up to when
+  *        the test case ends, or 0 for no quota. A test case over it fails.
+  */
+  size_t scratch_quota{ 0 };
+  /** @brief Log the I/O counters (see IoCounters) of each test case. */
+  bool report_io{ false };
+  /**
+  * @brief In isolated mode, trace the child with ptrace and log how many
+  *        times each test case made each syscall. Linux on x86-64 and
+  *        AArch64 only.
+  */
+  bool trace_syscalls{ false };
+  /** @brief Seed of the run, from which TestSeed() is derived. */
+  uint64_t seed{ 0 };
+  /**
+  * @brief Run each test case on a thread with a stack of this many bytes,
+  *        painted before and scanned after it, and log how much of it the
+  *        test case used. A guard page below it turns an overflow into a
+  *        crash. 0 runs test cases on the calling thread. Ignored on Windows.
+  */
+  size_t stack_size{ 0 };
+  /**
+  * @brief Log the threads (with their names) and the file descriptors (with
+  *        their targets) that each test case leaves open. Linux only.
+  */
+  bool detect_leaks{ false };
+  /** @brief Fail the test cases that leak threads or file descriptors. */
+  bool fail_leaks{ false };
+  /**
+  * @brief Comma separated tags (see UNIT_TAGS): only the test cases with one
+  *        of them are run, or all if null. Ignored in MICROUNIT_FREESTANDING
+  *        mode.
+  */
+  const char *tags{ nullptr };
+  /**
+  * @brief CPU time of the running thread, in seconds, after which no more
+  *        test cases are started, or 0 for no budget.
+  */
+  double cpu_budget{ 0 };
+  /**
+  * @brief Run each test case twice, the second time without output, and
+  *        fail the ones whose outcome, output or recorded state (see
+  *        RecordState) differs between the runs. Ignored in
+  *        MICROUNIT_FREESTANDING mode.
+  */
+  bool check_determinism{ false };
+  /**
+  * @brief NUMA node whose CPUs the run is pinned to, or -1 to leave it
+  *        unpinned. The test cases, the threads and children they start, and
+  *        the fixtures they build then run there, and the memory they touch
+  *        first is allocated there. Each test case logs the node and CPU it
+  *        ran on. Linux only.
+  */
+  int numa_node{ -1 };
+};
+
+/**
+* @brief Static description of the place where a test stopped. One is built
+*        at compile time for each PASS/FAIL/ASSERT_* in the test bodies, with
+*        the file name already stripped of its directories.
+*/
+struct SourceLocation {
+  const char *file;
+  int line;
+  const char *message;
+};
+
+/**
+* @brief Log a test failure and mark the test as failed. Kept out of line and
+*        cold so that assertions only cost a compare-and-branch in the test
+*        bodies.
+*/
+MICROUNIT_COLD_DECLARATION void ReportFailure(const SourceLocation& location,
+                                              UnitFunctionResult *result);
+
+/**
+* @brief Log an explicit test pass and mark the test as passed.
+*/
+void ReportPass(const SourceLocation& location, UnitFunctionResult *result);
+
+/** @brief Start or end of a run. failure_count is only set at the end. */
+struct RunEvent {
+  size_t test_count;
+  size_t failure_count;
+};
+
+/** @brief Start or end of a test case. success is only set at the end. */
+struct TestEvent {
+  const char *name;
+  bool success;
+};
+
+/** @brief Failed assertion in the test case that is running. */
+struct FailureEvent {
+  const char *test_name;
+  const SourceLocation *location;
+};
+
+/**
+* @brief Receiver of test events, for custom metrics and reports. Override
+*        the functions of interest and register it with
+*        UnitTester::AddListener, or give a static policy to UnitTester::Run.
+*/
+class Listener {
+public:
+  virtual void OnRunStart(const RunEvent&) {}
+  virtual void OnRunEnd(const RunEvent&) {}
+  virtual void OnTestStart(const TestEvent&) {}
+  virtual void OnTestEnd(const TestEvent&) {}
+  virtual void OnAssertionFailure(const FailureEvent&) {}
+protected:
+  ~Listener() = default;
+};
+
+/**
+* @brief Base of static listener policies, see UnitTester::Run<Policy>. A
+*        policy hides the functions of interest with its own static ones.
+*/
+struct ListenerPolicy {
+  static void OnRunStart(const RunEvent&) {}
+  static void OnRunEnd(const RunEvent&) {}
+  static void OnTestStart(const TestEvent&) {}
+  static void OnTestEnd(const TestEvent&) {}
+  static void OnAssertionFailure(const FailureEvent&) {}
+};
+
+template <typename Event>
+using EventHook = void (*)(const Event&);
+
+/**
+* @brief The static functions of the listener policy of a run (see
+*        UnitTester::Run<Policy>), which the runner calls directly, without
+*        taking a listener slot. The ones that the policy does not hide are
+*        null, and cost nothing.
+*/
+struct PolicyHooks {
+  EventHook<RunEvent> on_run_start;
+  EventHook<RunEvent> on_run_end;
+  EventHook<TestEvent> on_test_start;
+  EventHook<TestEvent> on_test_end;
+  EventHook<FailureEvent> on_assertion_failure;
+
+  template <typename Policy>
+  static PolicyHooks For() {
+    return PolicyHooks{
+      Hook(&Policy::OnRunStart, &ListenerPolicy::OnRunStart),
+      Hook(&Policy::OnRunEnd, &ListenerPolicy::OnRunEnd),
+      Hook(&Policy::OnTestStart, &ListenerPolicy::OnTestStart),
+      Hook(&Policy::OnTestEnd, &ListenerPolicy::OnTestEnd),
+      Hook(&Policy::OnAssertionFailure, &ListenerPolicy::OnAssertionFailure)
+    };
+  }
+
+private:
+  template <typename Event>
+  static EventHook<Event> Hook(EventHook<Event> hook,
+                               EventHook<Event> empty) {
+    return hook == empty ? nullptr : hook;
+  }
+};
+
+/**
+* @brief Registered listeners, the policy of the run, and the name of the
+*        test case that is running for the failure events. Zero-initialized,
+*        like the registry of MICROUNIT_FREESTANDING mode.
+*/
+struct ListenerList {
+  Listener *listeners[MICROUNIT_MAX_LISTENERS];
+  size_t size;
+  const PolicyHooks *policy;
+  const char *test_name;
+};
+
+MICROUNIT_API ListenerList& Listeners();
+
+/**
+* @brief Send an event to the policy of the run and the registered
+*        listeners. The event is only built when one of them receives it, so
+*        that without them, each event costs two loads and a well predicted
+*        branch.
+*/
+template <typename Event, typename MakeEvent>
+inline void Notify(void (Listener::*hook)(const Event&),
+                   EventHook<Event> PolicyHooks::*policy_hook,
+                   const MakeEvent& make_event) {
+  ListenerList& list = Listeners();
+  if (MICROUNIT_UNLIKELY(list.size != 0 || list.policy != nullptr)) {
+    const EventHook<Event> direct = list.policy ?
+      list.policy->*policy_hook : nullptr;
+    if (!direct && list.size == 0) return;
+    const Event event = make_event();
+    if (direct) direct(event);
+    for (size_t i = 0; i < list.size; ++i) {
+      (list.listeners[i]->*hook)(event);
+    }
+  }
+}
+
+#if !defined(MICROUNIT_FREESTANDING)
+/**
+* @brief Test case registered at run time with captured state (see
+*        UnitTester::RegisterCallable). The callable is stored in place when
+*        it fits the inline buffer, and on the heap otherwise. The objects
+*        are constructed in fixed-size slots of contiguous blocks owned by
+*        the registry, and never move.
+*/
+class DynamicUnit {
+public:
+  static const size_t kInlineSize = 56;
+  static const size_t kInlineAlignment = 16;
+
+  /** @brief Tag for callables that also take the index of a parameter. */
+  struct Indexed {};
+
+  template <typename Callable>
+  explicit DynamicUnit(Callable callable)
+    : invoke_(&Invoke<Callable>), destroy_(&Destroy<Callable>) {
+    Construct(static_cast<Callable&&>(callable),
+              Fits<sizeof(Callable) <= kInlineSize &&
+                   alignof(Callable) <= kInlineAlignment>());
+  }
+  template <typename Callable>
+  DynamicUnit(Callable callable, Indexed)
+    : invoke_(&InvokeIndexed<Callable>), destroy_(&Destroy<Callable>) {
+    Construct(static_cast<Callable&&>(callable),
+              Fits<sizeof(Callable) <= kInlineSize &&
+                   alignof(Callable) <= kInlineAlignment>());
+  }
+  ~DynamicUnit() {
+    destroy_(object_, object_ != buffer_);
+  }
+  DynamicUnit(const DynamicUnit&) = delete;
+  DynamicUnit& operator=(const DynamicUnit&) = delete;
+
+  void Run(UnitFunctionResult *result, size_t index = 0) {
+    invoke_(object_, result, index);
+  }
+
+private:
+  template <bool Value> struct Fits {};
+
+  template <typename Callable>
+  void Construct(Callable&& callable, Fits<true>) {
+    object_ = new (buffer_) Callable(static_cast<Callable&&>(callable));
+  }
+  template <typename Callable>
+  void Construct(Callable&& callable, Fits<false>) {
+    object_ = new Callable(static_cast<Callable&&>(callable));
+  }
+  template <typename Callable>
+  static void Invoke(void *object, UnitFunctionResult *result, size_t) {
+    (*static_cast<Callable*>(object))(result);
+  }
+  template <typename Callable>
+  static void InvokeIndexed(void *object, UnitFunctionResult *result,
+                            size_t index) {
+    (*static_cast<Callable*>(object))(result, index);
+  }
+  template <typename Callable>
+  static void Destroy(void *object, bool on_heap) {
+    if (on_heap) {
+      delete static_cast<Callable*>(object);
+    } else {
+      static_cast<Callable*>(object)->~Callable();
+    }
+  }
+
+  alignas(kInlineAlignment) unsigned char buffer_[kInlineSize];
+  void (*invoke_)(void*, UnitFunctionResult*, size_t);
+  void (*destroy_)(void*, bool);
+  void *object_;
+};
+#endif
+
+/**
+* @brief Main class for unit test management. This class is a singleton
+*        and maintains a list of all registered unit test cases.
+*/
+class UnitTester {
+public:
+  /**
+  * @brief Run all the registered unit test cases.
+  * @param [in] options  Options for this run.
+  * @returns True if all tests pass, false otherwise.
+  */
+  MICROUNIT_API static bool Run(const RunOptions& options = RunOptions());
+
+  /**
+  * @brief Run all the registered unit test cases, and send the events of
+  *        this run to a static listener policy (see ListenerPolicy) as well
+  *        as to the registered listeners.
+  * @code{.cpp}
+  *  struct CountFailures : microunit::ListenerPolicy {
+  *    static void OnAssertionFailure(const microunit::FailureEvent& e) {
+  *      ++failures;
+  *    }
+  *  };
+  *  microunit::UnitTester::Run<CountFailures>();
+  * @endcode
+  */
+  template <typename Policy>
+  static bool Run(const RunOptions& options = RunOptions()) {
+    const PolicyHooks hooks = PolicyHooks::For<Policy>();
+    ListenerList& list = Listeners();
+    const PolicyHooks *previous = list.policy;
+    list.policy = &hooks;
+    const bool success = Run(options);
+    list.policy = previous;
+    return success;
+  }
+
+  /**
+  * @brief Register a listener for the test events. The listener must stay
+  *        alive until it is removed.
+  * @returns False if MICROUNIT_MAX_LISTENERS listeners are registered.
+  */
+  MICROUNIT_API static bool AddListener(Listener *listener);
+
+  /** @brief Unregister a listener added with AddListener. */
+  MICROUNIT_API static void RemoveListener(Listener *listener);
+
+  /**
+  * @brief Register a unit test case function. In regular library client usage,
+  *        this doesn't need to be called, and the macro UNIT should be used
+  *        instead.
+  * @param [in] name  Name of the unit test case.
+  * @param [in] function  Pointer to unit test case function.
+  * @param [in] type_name  For typed test cases, name of the type the
+  *                        function was instantiated for (see TYPED_UNIT).
+  */
+  MICROUNIT_API static void RegisterFunction(const char *name,
+                                             UnitFunction function,
+                                             const char *type_name = nullptr);
+#if !defined(MICROUNIT_LEAN) && !defined(MICROUNIT_FREESTANDING)
+  static void RegisterFunction(const std::string &name,
+                               UnitFunction function) {
+    RegisterFunction(name.c_str(), function);
+  }
+#endif
+
+  /**
+  * @brief Register a function to be called once all test cases have run.
+  *        Used to release fixtures that outlive a single test case.
+  * @param [in] function  Pointer to the teardown function.
+  */
+  MICROUNIT_API static void RegisterTeardown(void(*function)());
+
+#if !defined(MICROUNIT_FREESTANDING)
+  /**
+  * @brief Register a test case that runs a callable, with any captured
+  *        state, at run time. It is run, filtered and reported like the
+  *        UNIT test cases. Use UNIT_LAMBDA to write the callable.
+  * @param [in] name  Name of the unit test case. It is copied.
+  * @param [in] callable  Callable taking a UnitFunctionResult pointer.
+  */
+  template <typename Callable>
+  static void RegisterCallable(const char *name, Callable callable) {
+    RegisterDynamic(name, new (AllocateDynamicUnit())
+      DynamicUnit(static_cast<Callable&&>(callable)));
+  }
+
+  /**
+  * @brief Register a test case that runs once per parameter of a lazy
+  *        generator. Only the generator is stored: the runner expands it
+  *        into (test case, index) work items as it goes. Used by PARAM_UNIT.
+  * @param [in] name  Name of the unit test case. It is copied.
+  * @param [in] generator  Object with Size() and At(index) members.
+  * @param [in] function  Called with the result and each parameter.
+  */
+  template <typename Generator, typename Function>
+  static void RegisterParameterized(const char *name, Generator generator,
+                                    Function function) {
+    const size_t parameters = generator.Size();
+    RegisterDynamic(name, new (AllocateDynamicUnit()) DynamicUnit(
+      [generator, function](UnitFunctionResult *result, size_t index) {
+        function(result, generator.At(index));
+      }, DynamicUnit::Indexed()), true, parameters);
+  }
+
+  /**
+  * @brief Register a function that adjusts the resource limits of a test
+  *        case in isolated mode. Used by the UNIT_LIMITS macro.
+  * @param [in] name  Name of the unit test case.
+  * @param [in] function  Called with the default limits of the run.
+  */
+  MICROUNIT_API static void RegisterLimits(const char *name,
+                                           void(*function)(ResourceLimits&));
+
+  /**
+  * @brief Give a test case comma separated tags. Used by UNIT_TAGS.
+  * @param [in] name  Name of the unit test case.
+  * @param [in] tags  Tags, added to those it already has.
+  */
+  MICROUNIT_API static void RegisterTags(const char *name, const char *tags);
+
+  /**
+  * @brief Run the test cases selected by the command line, and return the
+  *        exit code for main(). See the usage printed with --help.
+  */
+  MICROUNIT_API static int Main(int argc, char **argv);
+#endif
+
+  /**
+  * @brief Helper class to register a unit test in construction time. This is
+  *        used to call RegisterFunction in the construction of a static
+  *        helper object. Used by the REGISTER_UNIT macro, which in turn is
+  *        used by the UNIT macro.
+  */
+  class Registrator {
+  public:
+    Registrator(const char *name,
+                UnitFunction function) {
+      UnitTester::RegisterFunction(name, function);
+    };
+    Registrator(const Registrator&) = delete;
+    Registrator(Registrator&&) = delete;
+    ~Registrator() = default;
+  };
+
+#if !defined(MICROUNIT_FREESTANDING)
+  /**
+  * @brief Helper class to register a parameterized unit test in construction
+  *        time. Used by the PARAM_UNIT macro.
+  */
+  class ParameterizedRegistrator {
+  public:
+    template <typename Generator, typename Function>
+    ParameterizedRegistrator(const char *name, Generator generator,
+                             Function function) {
+      UnitTester::RegisterParameterized(name, generator, function);
+    }
+    ParameterizedRegistrator(const ParameterizedRegistrator&) = delete;
+    ParameterizedRegistrator(ParameterizedRegistrator&&) = delete;
+  };
+
+  /**
+  * @brief Helper class to set the resource limits of a test case in
+  *        construction time. Used by the UNIT_LIMITS macro.
+  */
+  class LimitsRegistrator {
+  public:
+    LimitsRegistrator(const char *name, void(*function)(ResourceLimits&)) {
+      UnitTester::RegisterLimits(name, function);
+    }
+    LimitsRegistrator(const LimitsRegistrator&) = delete;
+    LimitsRegistrator(LimitsRegistrator&&) = delete;
+  };
+
+  /**
+  * @brief Helper class to tag a test case in construction time. Used by the
+  *        UNIT_TAGS macro.
+  */
+  class TagsRegistrator {
+  public:
+    TagsRegistrator(const char *name, const char *tags) {
+      UnitTester::RegisterTags(name, tags);
+    }
+    TagsRegistrator(const TagsRegistrator&) = delete;
+    TagsRegistrator(TagsRegistrator&&) = delete;
+  };
+#endif
+
+  UnitTester() = delete;
+  UnitTester(const UnitTester&) = delete;
+  UnitTester(UnitTester&&) = delete;
+
+private:
+  struct Registry;
+  MICROUNIT_API static Registry& Instance();
+#if !defined(MICROUNIT_FREESTANDING)
+  MICROUNIT_API static void* AllocateDynamicUnit();
+  MICROUNIT_API static void RegisterDynamic(const char *name,
+                                            DynamicUnit *unit,
+                                            bool parameterized = false,
+                                            size_t parameters = 0);
+#endif
+};
+}
+
+namespace microunit {
+/**
+* @brief List of types over which a TYPED_UNIT is instantiated.
+*/
+template <typename... Ts>
+struct Types {};
+
+/** @brief Helper to accept either a type pack or an existing Types list. */
+template <typename... Ts>
+struct MakeTypes {
+  typedef Types<Ts...> type;
+};
+template <typename... Ts>
+struct MakeTypes<Types<Ts...>> {
+  typedef Types<Ts...> type;
+};
+
+/**
+* @brief Readable name of a type, used to name typed test instances. The
+*        fixed-width integer and floating point types have their usual names;
+*        other types are named after the compiler's spelling. Use
+*        MICROUNIT_TYPE_NAME inside namespace microunit to override it.
+*/
+template <typename T>
+struct TypeName {
+  static const char* Get() {
+    // Zero-initialized and filled on first use, so that it needs no guard
+    // variable (and no runtime support) for its initialization.
+#if defined(_MSC_VER)
+    static char name[sizeof(__FUNCSIG__)];
+    if (name[0] == '\0') Parse(__FUNCSIG__, name);
+#else
+    static char name[sizeof(__PRETTY_FUNCTION__)];
+    if (name[0] == '\0') Parse(__PRETTY_FUNCTION__, name);
+#endif
+    return name;
+  }
+private:
+  // Searched by hand, so that MICROUNIT_FREESTANDING needs no more of the C
+  // library than memcpy and strlen.
+  static const char* Find(const char *text, const char *part) {
+    for (; *text; ++text) {
+      size_t i = 0;
+      while (part[i] && text[i] == part[i]) ++i;
+      if (!part[i]) return text;
+    }
+    return nullptr;
+  }
+
+  static bool Parse(const char *signature, char *name) {
+#if defined(_MSC_VER)
+    const char *prefix = "TypeName<";
+    const char *begin = Find(signature, prefix);
+    const char *end = begin ? Find(begin, ">::Get") : nullptr;
+#else
+    const char *prefix = "T = ";
+    const char *begin = Find(signature, prefix);
+    const char *end = begin;
+    while (end && *end && *end != ']' && *end != ';') ++end;
+#endif
+    if (!begin || !end) {
+      memcpy(name, signature, strlen(signature) + 1);
+      return false;
+    }
+    begin += strlen(prefix);
+    memcpy(name, begin, end - begin);
+    name[end - begin] = '\0';
+    return true;
+  }
+};
+
+MICROUNIT_TYPE_NAME(bool)
+MICROUNIT_TYPE_NAME(char)
+MICROUNIT_TYPE_NAME(int8_t)
+MICROUNIT_TYPE_NAME(int16_t)
+MICROUNIT_TYPE_NAME(int32_t)
+MICROUNIT_TYPE_NAME(int64_t)
+MICROUNIT_TYPE_NAME(uint8_t)
+MICROUNIT_TYPE_NAME(uint16_t)
+MICROUNIT_TYPE_NAME(uint32_t)
+MICROUNIT_TYPE_NAME(uint64_t)
+MICROUNIT_TYPE_NAME(float)
+MICROUNIT_TYPE_NAME(double)
+MICROUNIT_TYPE_NAME(long double)
+
+/**
+* @brief Register one instance of a typed unit test per type in the list,
+*        named FUNCTION<type>. Used by the TYPED_UNIT macro.
+*/
+template <template <typename> class Unit, typename... Ts>
+void RegisterTyped(const char *name, Types<Ts...>) {
+  const int expand[] = { 0, (UnitTester::RegisterFunction(
+    name, &Unit<Ts>::Run, TypeName<Ts>::Get()), 0)... };
+  (void)expand;
+}
+}
+
+#if MICROUNIT_CPLUSPLUS >= 201402L
+namespace microunit {
+/**
+* @brief Result of a unit test that is evaluated at compile time (see
+*        STATIC_UNIT). Must stay a literal type.
+*/
+struct StaticUnitResult {
+  bool success{ true };
+};
+
+/**
+* @brief Called by STATIC_ASSERT_TRUE/STATIC_ASSERT_FALSE when the check does
+*        not hold. It is deliberately not constexpr: during constant
+*        evaluation, the compiler rejects the call and points at the failing
+*        assertion. At run time, it logs the failure.
+*/
+inline void StaticUnitAssertionFailed(StaticUnitResult& result,
+                                      const char *file, int line,
+                                      const char *message) {
+  TERMINAL_BAD << file << ":" << line << ": " << message;
+  result.success = false;
+  const SourceLocation location = { file, line, message };
+  Notify(&Listener::OnAssertionFailure, &PolicyHooks::on_assertion_failure,
+         [&]() {
+    return FailureEvent{ Listeners().test_name, &location };
+  });
+}
+}
+#endif
+
+#if (!defined(MICROUNIT_LEAN) || defined(MICROUNIT_IMPLEMENTATION)) &&        \
+    !defined(MICROUNIT_FREESTANDING)
+namespace microunit {
+/**
+* @brief Helper class to convert from color codes to ansi escape codes
+*        Used to print color in non-win32 systems.
+*/
+inline std::string ColorCodeToANSI(const int color_code) {
+  return AnsiColorCode(color_code);
+}
+
+/**
+* @brief Helper function to change the current terminal color.
+* @param [in] color_code Input color code.
+*/
+MICROUNIT_API void SetTerminalColor(int color_code);
+
+/**
+* @brief Helper class to be used as a iostream manipulator and change the
+*        terminal color.
+*/
+class Color {
+public:
+  Color(int code) : code_(code) {}
+  void Set() const {
+    SetTerminalColor(code_);
+  }
+  int code() const { return code_; }
+private:
+  int code_;
+};
+
+const static Color Grey{ COLORCODE_GREY };
+const static Color Green{ COLORCODE_GREEN };
+const static Color Red{ COLORCODE_RED };
+const static Color Yellow{ COLORCODE_YELLOW };
+
+/**
+* @brief Helper class to be used in a cout streaming statement. Resets to
+*        the default terminal color upon statement completion.
+*/
+class SaveColor {
+public:
+  ~SaveColor() {
+    SetTerminalColor(Grey.code());
+  };
+};
+
+/**
+* @brief Helper class to be used in a cout streaming statement. Puts a line
+*        break upon statement completion.
+*/
+class EndingLineBreak {
+public:
+  ~EndingLineBreak() {
+    WriteOutput("\n", 1);
+  };
+};
+}
+
+#if defined(MICROUNIT_STREAMS)
+/** @brief Operator to allow using SaveColor class with an ostream */
+inline std::ostream& operator<<(std::ostream& os,
+                                const microunit::SaveColor& obj) {
+  return os;
+}
+
+/** @brief Operator to allow using EndingLineBreak class with an ostream */
+inline std::ostream& operator<<(std::ostream& os,
+                                const microunit::EndingLineBreak& obj) {
+  return os;
+}
+
+/** @brief Operator to allow using Color class with an ostream */
+inline std::ostream& operator<<(std::ostream& os,
+                                const microunit::Color& color) {
+  color.Set();
+  return os;
+}
+#endif
+
+namespace microunit {
+#if defined(MICROUNIT_STREAMS)
+/** @brief Log any value that can be written to an std::ostream. */
+template <typename T>
+LogLine& LogLine::operator<<(const T& value) {
+  Stream() << value;
+  return *this;
+}
+
+inline LogLine& LogLine::operator<<(
+    std::ostream& (*manipulator)(std::ostream&)) {
+  manipulator(Stream());
+  return *this;
+}
+
+inline LogLine& LogLine::operator<<(
+    std::ios_base& (*manipulator)(std::ios_base&)) {
+  manipulator(Stream());
+  return *this;
+}
+
+inline std::ostream& LogLine::Stream() {
+  if (!stream_) stream_.reset(new std::ostringstream);
+  return *stream_;
+}
+
+/** @brief Move the text of the stream to the line, and drop the stream. */
+inline void LogLine::Drain() {
+  if (!stream_) return;
+  const std::string text = stream_->str();
+  stream_.reset();
+  Append(text.data(), text.size());
+}
+#endif
+
+#if defined(MICROUNIT_HAS_PMR)
+/**
+* @brief Bump allocator for test bodies. Allocation is a pointer increment,
+*        deallocation only updates the leak counter, and all memory is
+*        reclaimed at once by Reset(), which UnitTester::Run calls after
+*        each test case. Blocks are kept across resets and reused.
+*/
+class ArenaResource : public std::pmr::memory_resource {
+public:
+  explicit ArenaResource(const ArenaOptions& options = ArenaOptions())
+    : options_(options) {}
+  ~ArenaResource() override {
+    for (auto& chunk : chunks_) {
+      FreeChunk(chunk);
+    }
+  }
+  ArenaResource(const ArenaResource&) = delete;
+  ArenaResource& operator=(const ArenaResource&) = delete;
+
+  /**
+  * @brief Release every allocation at once.
+  * @returns Number of bytes that were allocated and never deallocated.
+  */
+  size_t Reset() {
+    const size_t leaked = outstanding_;
+    for (size_t i = 0; i <= current_ && i < chunks_.size(); ++i) {
+      Poison(chunks_[i].base, i == current_ ? used_ : chunks_[i].size);
+    }
+    current_ = 0;
+    used_ = 0;
+    outstanding_ = 0;
+    return leaked;
+  }
+
+  /** @brief Bytes allocated and not yet deallocated since the last reset. */
+  size_t outstanding() const { return outstanding_; }
+
+private:
+  struct Chunk {
+    char *base;
+    size_t size;
+    bool mapped;
+  };
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    while (current_ < chunks_.size()) {
+      Chunk& chunk = chunks_[current_];
+      const size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+      if (offset + bytes <= chunk.size) {
+        used_ = offset + bytes;
+        outstanding_ += bytes;
+        Unpoison(chunk.base + offset, bytes);
+        return chunk.base + offset;
+      }
+      ++current_;
+      used_ = 0;
+    }
+    chunks_.push_back(AllocateChunk(
+      std::max(options_.chunk_size, bytes + alignment)));
+    return do_allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void*, size_t bytes, size_t) override {
+    outstanding_ -= bytes;
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const
+    noexcept override {
+    return this == &other;
+  }
+
+  MICROUNIT_API Chunk AllocateChunk(size_t size);
+  MICROUNIT_API static void FreeChunk(Chunk& chunk);
+  MICROUNIT_API void Poison(char *base, size_t size) const;
+  MICROUNIT_API static void Unpoison(char *base, size_t size);
+
+  ArenaOptions options_;
+  std::vector<Chunk> chunks_;
+  size_t current_{ 0 };
+  size_t used_{ 0 };
+  size_t outstanding_{ 0 };
+};
+
+/**
+* @brief Arena of the test case running on the calling thread, or nullptr.
+*/
+MICROUNIT_API ArenaResource*& CurrentArena();
+
+/**
+* @brief Memory resource for use in test bodies. This is the per-test arena
+*        when RunOptions::arena is set, and the default resource otherwise.
+* @code{.cpp}
+*  UNIT(Test_Sort) {
+*    std::pmr::vector<int> values(microunit::TestArena());
+*    // ...
+*  };
+* @endcode
+*/
+inline std::pmr::memory_resource* TestArena() {
+  if (CurrentArena()) return CurrentArena();
+  return std::pmr::get_default_resource();
+}
+#endif
+}
+
+namespace microunit {
+/**
+* @brief Time source used by time-dependent code under test. Production code
+*        takes a Clock& and uses RealClock::Instance(); unit tests pass a
+*        VirtualClock instead, so that sleeps and timeouts don't really wait.
+*/
+class Clock {
+public:
+  typedef std::chrono::steady_clock::duration duration;
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  virtual ~Clock() {};
+
+  /** @brief Current time of this clock. */
+  virtual time_point Now() = 0;
+
+  /** @brief Block the calling thread until the given time is reached. */
+  virtual void SleepUntil(time_point deadline) = 0;
+
+  /** @brief Block the calling thread for the given duration. */
+  void SleepFor(duration period) {
+    SleepUntil(Now() + period);
+  }
+};
+
+/**
+* @brief Clock backed by std::chrono::steady_clock and real sleeps.
+*/
+class RealClock : public Clock {
+public:
+  time_point Now() override {
+    return std::chrono::steady_clock::now();
+  }
+  void SleepUntil(time_point deadline) override {
+    std::this_thread::sleep_until(deadline);
+  }
+
+  /** @brief Process-wide real clock instance. */
+  static RealClock& Instance() {
+    static RealClock instance;
+    return instance;
+  }
+};
+
+/**
+* @brief Deterministic clock for unit tests. Time only moves when it is
+*        explicitly advanced, or when every participant thread is blocked in
+*        SleepUntil/SleepFor, in which case it jumps straight to the earliest
+*        pending wake-up or timer. Timers fire in time order (ties in the
+*        order they were added) on the thread that advances the clock.
+*
+*        The number of participants is the number of threads that sleep on
+*        this clock concurrently (1 by default, i.e. the test thread itself).
+*        A thread that stops using the clock must call RemoveParticipant, or
+*        the remaining ones would wait for it forever.
+* @code{.cpp}
+*  UNIT(Test_Backoff) {
+*    microunit::VirtualClock clock;
+*    auto start = clock.Now();
+*    RetryWithBackoff(clock, 5);  // Sleeps 1+2+4+8+16 seconds, instantly.
+*    ASSERT_TRUE(clock.Now() - start == std::chrono::seconds(31));
+*  };
+* @endcode
+*/
+class VirtualClock : public Clock {
+public:
+  explicit VirtualClock(int participants = 1)
+    : participants_(participants) {}
+
+  time_point Now() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return now_;
+  }
+
+  void SleepUntil(time_point deadline) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (deadline <= now_) return;
+    sleepers_.insert(deadline);
+    AdvanceWhileIdle(lock);
+    wakeup_.wait(lock, [&] { return now_ >= deadline; });
+  }
+
+  /**
+  * @brief Move time forward by the given period, firing due timers and
+  *        waking due sleepers in time order.
+  */
+  void Advance(duration period) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const time_point target = now_ + period;
+    while (!timers_.empty() && timers_.begin()->first.first <= target) {
+      FireNextTimer(lock);
+    }
+    MoveTo(target);
+  }
+
+  /**
+  * @brief Schedule a callback to run when the clock reaches the given time.
+  *        The callback runs without the clock lock held, so it may use the
+  *        clock (e.g. to re-arm itself).
+  */
+  void AddTimer(time_point when, std::function<void()> callback) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    timers_.emplace(std::make_pair(when, timer_sequence_++),
+                    std::move(callback));
+  }
+
+  /** @brief Register one more thread that sleeps on this clock. */
+  void AddParticipant() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++participants_;
+  }
+
+  /** @brief Unregister a thread that no longer sleeps on this clock. */
+  void RemoveParticipant() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    --participants_;
+    AdvanceWhileIdle(lock);
+  }
+
+private:
+  typedef std::pair<time_point, unsigned long long> TimerKey;
+
+  // Set the current time and release every sleeper that is now due.
+  void MoveTo(time_point when) {
+    if (when > now_) now_ = when;
+    sleepers_.erase(sleepers_.begin(), sleepers_.upper_bound(now_));
+    wakeup_.notify_all();
+  }
+
+  void FireNextTimer(std::unique_lock<std::mutex>& lock) {
+    auto timer = timers_.begin();
+    std::function<void()> callback = std::move(timer->second);
+    MoveTo(timer->first.first);
+    timers_.erase(timer);
+    lock.unlock();
+    callback();
+    lock.lock();
+  }
+
+  // While all participants are blocked, jump to the next event in time.
+  void AdvanceWhileIdle(std::unique_lock<std::mutex>& lock) {
+    while (!sleepers_.empty() &&
+           static_cast<int>(sleepers_.size()) >= participants_) {
+      const time_point next_wakeup = *sleepers_.begin();
+      if (!timers_.empty() && timers_.begin()->first.first <= next_wakeup) {
+        FireNextTimer(lock);
+      } else {
+        MoveTo(next_wakeup);
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  time_point now_{};
+  int participants_;
+  std::multiset<time_point> sleepers_;
+  std::map<TimerKey, std::function<void()>> timers_;
+  unsigned long long timer_sequence_{ 0 };
+};
+}
+
+namespace microunit {
+/**
+* @brief File I/O used by the code under test. Production code takes a
+*        FileIo& and uses RealFileIo::Instance(); unit tests pass a
+*        FaultyFileIo instead, to exercise the paths of short reads and
+*        writes, errors and slow disks.
+*/
+class FileIo {
+public:
+  virtual ~FileIo() {};
+
+  /** @brief Like read(2): bytes read, 0 at the end, or -1 with errno set. */
+  virtual ptrdiff_t Read(int fd, void *buffer, size_t size) = 0;
+
+  /** @brief Like write(2): bytes written, or -1 with errno set. */
+  virtual ptrdiff_t Write(int fd, const void *buffer, size_t size) = 0;
+};
+
+/**
+* @brief File I/O with the read and write system calls.
+*/
+class RealFileIo : public FileIo {
+public:
+  MICROUNIT_API ptrdiff_t Read(int fd, void *buffer, size_t size) override;
+  MICROUNIT_API ptrdiff_t Write(int fd, const void *buffer,
+                                size_t size) override;
+
+  /** @brief Process-wide real file I/O instance. */
+  static RealFileIo& Instance() {
+    static RealFileIo instance;
+    return instance;
+  }
+};
+
+/**
+* @brief A fault that a FaultyFileIo injects into reads or writes: on every
+*        Nth call, or on each call with a probability, transfer fewer bytes
+*        than requested, fail with an errno value, or sleep first.
+* @code{.cpp}
+*  io.OnRead(microunit::Fault::Every(3).Short(0.5));
+*  io.OnWrite(microunit::Fault::WithProbability(0.01).Fail(ENOSPC));
+*  io.OnWrite(microunit::Fault::WithProbability(0.2).Sleep(
+*    std::chrono::milliseconds(5)));
+* @endcode
+*/
+struct Fault {
+  enum Action { kNone, kShort, kFail, kSleep };
+
+  size_t every{ 0 };
+  double probability{ 0 };
+  Action action{ kNone };
+  double fraction{ 1 };
+  int error{ 0 };
+  Clock::duration delay{};
+
+  /** @brief On the Nth call, the 2Nth call, and so on. */
+  static Fault Every(size_t calls) {
+    Fault fault;
+    fault.every = calls;
+    return fault;
+  }
+
+  /** @brief On each call with the given probability. */
+  static Fault WithProbability(double probability) {
+    Fault fault;
+    fault.probability = probability;
+    return fault;
+  }
+
+  /** @brief Transfer this fraction of the requested bytes, at least one. */
+  Fault Short(double part) const {
+    Fault fault = *this;
+    fault.action = kShort;
+    fault.fraction = part;
+    return fault;
+  }
+
+  /** @brief Fail with -1 and errno set to the given value, e.g. EINTR. */
+  Fault Fail(int error_number) const {
+    Fault fault = *this;
+    fault.action = kFail;
+    fault.error = error_number;
+    return fault;
+  }
+
+  /** @brief Sleep for the given period on the clock of the FaultyFileIo. */
+  Fault Sleep(Clock::duration period) const {
+    Fault fault = *this;
+    fault.action = kSleep;
+    fault.delay = period;
+    return fault;
+  }
+};
+
+/**
+* @brief File I/O that injects programmed faults into the calls it forwards
+*        to another FileIo. The random faults come from its own generator, so
+*        the same seed (e.g. TestSeed()) gives the same faults on every run
+*        and platform. Sleeps go through a Clock, which can be a
+*        VirtualClock. The faults of a call are checked in the order they
+*        were added, and a failure ends the call.
+* @code{.cpp}
+*  UNIT(Test_Copy_Retries) {
+*    microunit::FaultyFileIo io(microunit::TestSeed());
+*    io.OnRead(microunit::Fault::Every(3).Short(0.5));
+*    io.OnWrite(microunit::Fault::WithProbability(0.1).Fail(EINTR));
+*    ASSERT_TRUE(CopyFile(io, source, destination));
+*  };
+* @endcode
+*/
+class FaultyFileIo : public FileIo {
+public:
+  explicit FaultyFileIo(uint64_t seed,
+                        FileIo& target = RealFileIo::Instance(),
+                        Clock& clock = RealClock::Instance())
+    : target_(target), clock_(clock), state_(seed) {}
+
+  /** @brief Add a fault to the schedule of the reads. */
+  void OnRead(const Fault& fault) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reads_.faults.push_back(fault);
+  }
+
+  /** @brief Add a fault to the schedule of the writes. */
+  void OnWrite(const Fault& fault) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writes_.faults.push_back(fault);
+  }
+
+  ptrdiff_t Read(int fd, void *buffer, size_t size) override {
+    if (!Inject(reads_, &size)) return -1;
+    return target_.Read(fd, buffer, size);
+  }
+
+  ptrdiff_t Write(int fd, const void *buffer, size_t size) override {
+    if (!Inject(writes_, &size)) return -1;
+    return target_.Write(fd, buffer, size);
+  }
+
+  /** @brief Number of faults injected so far. */
+  size_t Injected() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return injected_;
+  }
+
+private:
+  struct Schedule {
+    std::vector<Fault> faults;
+    size_t calls{ 0 };
+  };
+
+  // Apply the faults due on this call, and tell whether it goes ahead.
+  bool Inject(Schedule& schedule, size_t *size) {
+    Clock::duration delay{};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++schedule.calls;
+      for (const Fault& fault : schedule.faults) {
+        const bool due = fault.every ? schedule.calls % fault.every == 0 :
+          NextUniform() < fault.probability;
+        if (!due || fault.action == Fault::kNone) continue;
+        ++injected_;
+        if (fault.action == Fault::kFail) {
+          errno = fault.error;
+          return false;
+        }
+        if (fault.action == Fault::kSleep) {
+          delay += fault.delay;
+        } else if (*size > 1) {
+          const size_t part = static_cast<size_t>(
+            static_cast<double>(*size) * fault.fraction);
+          *size = part > 0 ? part : 1;
+        }
+      }
+    }
+    if (delay > Clock::duration::zero()) clock_.SleepFor(delay);
+    return true;
+  }
+
+  // Uniform in [0, 1), from a SplitMix64 generator.
+  double NextUniform() {
+    uint64_t value = (state_ += 0x9E3779B97F4A7C15ull);
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return static_cast<double>(value >> 11) / 9007199254740992.0;
+  }
+
+  FileIo& target_;
+  Clock& clock_;
+  std::mutex mutex_;
+  uint64_t state_;
+  Schedule reads_;
+  Schedule writes_;
+  size_t injected_{ 0 };
+};
+}
+
+namespace microunit {
+/**
+* @brief Trait to detect whether a fixture type provides a Reset() method.
+*/
+template <typename T>
+class HasReset {
+  template <typename U>
+  static char Check(decltype(&U::Reset));
+  template <typename U>
+  static long Check(...);
+public:
+  static const bool value = sizeof(Check<T>(nullptr)) == sizeof(char);
+};
+
+/**
+* @brief Storage for per-test fixtures (see UNIT_F). Every test case gets its
+*        own fixture instance. If the fixture type has a Reset() method,
+*        instances are recycled and Reset() is called instead of constructing
+*        a new one. Idle instances are destroyed after all tests have run.
+*/
+template <typename T, bool Resettable = HasReset<T>::value>
+class PerTestFixture {
+public:
+  static void Run(UnitFunctionResult *result,
+                  void(*body)(UnitFunctionResult*, T&)) {
+    T fixture;
+    body(result, fixture);
+  }
+};
+
+template <typename T>
+class PerTestFixture<T, true> {
+public:
+  static void Run(UnitFunctionResult *result,
+                  void(*body)(UnitFunctionResult*, T&)) {
+    Pooled *pooled = Acquire();
+    body(result, pooled->fixture);
+    std::lock_guard<std::mutex> lock(Mutex());
+    pooled->next = Pool();
+    Pool() = pooled;
+  }
+
+private:
+  // The idle fixtures form a list, without std containers or smart
+  // pointers: GCC 12 fails to instantiate those for a fixture type in a file
+  // that imports the module.
+  struct Pooled {
+    T fixture;
+    Pooled *next;
+  };
+  static Pooled* Acquire() {
+    {
+      std::lock_guard<std::mutex> lock(Mutex());
+      if (Pooled *pooled = Pool()) {
+        Pool() = pooled->next;
+        pooled->fixture.Reset();
+        return pooled;
+      }
+      static bool teardown_registered = false;
+      if (!teardown_registered) {
+        UnitTester::RegisterTeardown(&Teardown);
+        teardown_registered = true;
+      }
+    }
+    return new Pooled();
+  }
+  static void Teardown() {
+    std::lock_guard<std::mutex> lock(Mutex());
+    while (Pooled *pooled = Pool()) {
+      Pool() = pooled->next;
+      delete pooled;
+    }
+  }
+  static std::mutex& Mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+  static Pooled*& Pool() {
+    static Pooled *pool = nullptr;
+    return pool;
+  }
+};
+
+/**
+* @brief Set while a test case runs for the first of the two times of
+*        RunOptions::check_determinism, so that its shared fixtures are only
+*        released by the second run and are not rebuilt in between.
+*/
+inline bool& HoldSharedFixtures() {
+  static bool hold = false;
+  return hold;
+}
+
+/**
+* @brief Storage for suite-level fixtures (see UNIT_SHARED). The fixture is
+*        built lazily by its first user, shared read-only by all the test
+*        cases that declare it (possibly concurrently), and destroyed as soon
+*        as the last of them has run, or at the end of the run if some of
+*        them were not executed.
+*/
+template <typename T>
+class SharedFixture {
+public:
+  static void Run(UnitFunctionResult *result,
+                  void(*body)(UnitFunctionResult*, const T&)) {
+    body(result, Acquire());
+    if (!HoldSharedFixtures()) Release();
+  }
+
+  /**
+  * @brief Helper class to declare a user of the fixture in construction
+  *        time. Used by the UNIT_SHARED macro.
+  */
+  class User {
+  public:
+    User() {
+      std::lock_guard<std::mutex> lock(State().mutex);
+      if (State().users++ == 0) {
+        UnitTester::RegisterTeardown(&Teardown);
+      }
+      State().remaining = State().users;
+    }
+    User(const User&) = delete;
+    User(User&&) = delete;
+  };
+
+private:
+  // A plain pointer, for the same reason as the pool of PerTestFixture.
+  struct Storage {
+    std::mutex mutex;
+    T *instance{ nullptr };
+    int users{ 0 };
+    int remaining{ 0 };
+  };
+  static Storage& State() {
+    static Storage storage;
+    return storage;
+  }
+  static const T& Acquire() {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    if (!State().instance) {
+      State().instance = new T();
+    }
+    return *State().instance;
+  }
+  static void Release() {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    if (--State().remaining == 0) {
+      delete State().instance;
+      State().instance = nullptr;
+    }
+  }
+  static void Teardown() {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    delete State().instance;
+    State().instance = nullptr;
+    State().remaining = State().users;
+  }
+};
+}
+
+namespace microunit {
+/**
+* @brief Lazy arithmetic sequence of the values from begin (included) to end
+*        (excluded), see Range. Generators are random access: Size() and
+*        At(index) compute parameters on demand, so that a PARAM_UNIT over
+*        millions of them needs no storage.
+*/
+template <typename T>
+class RangeGenerator {
+public:
+  RangeGenerator(T begin, T end, T step)
+    : begin_(begin), end_(end), step_(step) {}
+  size_t Size() const {
+    if (!(begin_ < end_) || !(T(0) < step_)) return 0;
+    size_t size = static_cast<size_t>((end_ - begin_) / step_);
+    if (begin_ + static_cast<T>(size) * step_ < end_) ++size;
+    return size;
+  }
+  T At(size_t index) const {
+    return begin_ + static_cast<T>(index) * step_;
+  }
+private:
+  T begin_, end_, step_;
+};
+
+/** @brief Generator of the values in [begin, end), every step. */
+template <typename T>
+RangeGenerator<T> Range(T begin, T end, T step = T(1)) {
+  return RangeGenerator<T>(begin, end, step);
+}
+
+/** @brief Generator of a fixed list of values. */
+template <typename T>
+class ValuesGenerator {
+public:
+  explicit ValuesGenerator(std::initializer_list<T> values)
+    : shared_(new Shared{ std::vector<T>(values), { 1 } }) {}
+  ValuesGenerator(const ValuesGenerator& other) : shared_(other.shared_) {
+    ++shared_->references;
+  }
+  ValuesGenerator& operator=(const ValuesGenerator& other) {
+    ValuesGenerator copy(other);
+    std::swap(shared_, copy.shared_);
+    return *this;
+  }
+  ~ValuesGenerator() {
+    if (--shared_->references == 0) delete shared_;
+  }
+  size_t Size() const { return shared_->values.size(); }
+  T At(size_t index) const { return shared_->values[index]; }
+private:
+  // Shared, so that copies of the generator do not copy the values, and
+  // counted by hand: GCC 12 crashes on a std::shared_ptr of the values in a
+  // file that imports the module.
+  struct Shared {
+    std::vector<T> values;
+    std::atomic<size_t> references;
+  };
+  Shared *shared_;
+};
+
+/** @brief Generator of the given values. */
+template <typename T>
+ValuesGenerator<T> Values(std::initializer_list<T> values) {
+  return ValuesGenerator<T>(values);
+}
+
+/** @brief Compile-time list of indices, to expand generator tuples. */
+template <size_t... Is>
+struct IndexSequence {};
+template <size_t N, size_t... Is>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {};
+template <size_t... Is>
+struct MakeIndexSequence<0, Is...> {
+  typedef IndexSequence<Is...> type;
+};
+
+/**
+* @brief Generator of all the combinations of the parameters of other
+*        generators, as tuples. The last generator varies the fastest.
+*/
+template <typename... Generators>
+class CartesianGenerator {
+public:
+  typedef std::tuple<decltype(std::declval<const Generators&>().At(0))...>
+    Value;
+  explicit CartesianGenerator(Generators... generators)
+    : generators_(generators...), sizes_{ generators.Size()... } {}
+  size_t Size() const {
+    size_t size = 1;
+    for (size_t i = 0; i < sizeof...(Generators); ++i) size *= sizes_[i];
+    return size;
+  }
+  Value At(size_t index) const {
+    return At(index, typename MakeIndexSequence<sizeof...(Generators)>::type());
+  }
+private:
+  template <size_t... Is>
+  Value At(size_t index, IndexSequence<Is...>) const {
+    size_t digits[sizeof...(Generators)];
+    for (size_t i = sizeof...(Generators); i > 0; --i) {
+      digits[i - 1] = index % sizes_[i - 1];
+      index /= sizes_[i - 1];
+    }
+    return Value(std::get<Is>(generators_).At(digits[Is])...);
+  }
+  std::tuple<Generators...> generators_;
+  size_t sizes_[sizeof...(Generators)];
+};
+
+/** @brief Generator of the cartesian product of other generators. */
+template <typename... Generators>
+CartesianGenerator<Generators...> Cartesian(Generators... generators) {
+  return CartesianGenerator<Generators...>(generators...);
+}
+
+/**
+* @brief Generator of tuples of the parameters at the same index in other
+*        generators, as long as the shortest of them.
+*/
+template <typename... Generators>
+class ZipGenerator {
+public:
+  typedef std::tuple<decltype(std::declval<const Generators&>().At(0))...>
+    Value;
+  explicit ZipGenerator(Generators... generators)
+    : generators_(generators...), size_(MinimumSize({ generators.Size()... })) {}
+  size_t Size() const { return size_; }
+  Value At(size_t index) const {
+    return At(index, typename MakeIndexSequence<sizeof...(Generators)>::type());
+  }
+private:
+  static size_t MinimumSize(std::initializer_list<size_t> sizes) {
+    size_t size = *sizes.begin();
+    for (size_t each : sizes) size = each < size ? each : size;
+    return size;
+  }
+  template <size_t... Is>
+  Value At(size_t index, IndexSequence<Is...>) const {
+    return Value(std::get<Is>(generators_).At(index)...);
+  }
+  std::tuple<Generators...> generators_;
+  size_t size_;
+};
+
+/** @brief Generator that walks other generators in lockstep. */
+template <typename... Generators>
+ZipGenerator<Generators...> Zip(Generators... generators) {
+  return ZipGenerator<Generators...>(generators...);
+}
+}
+#endif
+
+#if defined(MICROUNIT_RUNNER) && !defined(MICROUNIT_FREESTANDING)
+namespace microunit {
+MICROUNIT_API void SetTerminalColor(int color_code) {
+#if defined(_WIN32)
+  HANDLE handler = GetStdHandle(STD_OUTPUT_HANDLE);
+  CONSOLE_SCREEN_BUFFER_INFO buffer_info;
+  GetConsoleScreenBufferInfo(handler, &buffer_info);
+  SetConsoleTextAttribute(handler, ((buffer_info.wAttributes & 0xFFF0) |
+    (WORD)color_code));
+#else
+  const std::string code = ColorCodeToANSI(color_code);
+  WriteOutput(code.data(), code.size());
+#endif
+}
+
+#if defined(MICROUNIT_HAS_PMR)
+MICROUNIT_API ArenaResource::Chunk ArenaResource::AllocateChunk(size_t size) {
+#if defined(__linux__)
+  const size_t huge_page = size_t(2) << 20;
+  size = (size + huge_page - 1) & ~(huge_page - 1);
+  void *base = MAP_FAILED;
+  if (options_.huge_pages) {
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+  if (base == MAP_FAILED) {
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) throw std::bad_alloc();
+    if (options_.huge_pages) madvise(base, size, MADV_HUGEPAGE);
+  }
+  Chunk chunk{ static_cast<char*>(base), size, true };
+#else
+  Chunk chunk{ static_cast<char*>(::operator new(size)), size, false };
+#endif
+  Poison(chunk.base, chunk.size);
+  return chunk;
+}
+
+MICROUNIT_API void ArenaResource::FreeChunk(Chunk& chunk) {
+  Unpoison(chunk.base, chunk.size);
+#if defined(__linux__)
+  if (chunk.mapped) {
+    munmap(chunk.base, chunk.size);
+    return;
+  }
+#endif
+  ::operator delete(chunk.base);
+}
+
+MICROUNIT_API void ArenaResource::Poison(char *base, size_t size) const {
+  if (!options_.poison) return;
+  Unpoison(base, size);
+  memset(base, 0xDD, size);
+#if defined(MICROUNIT_ASAN)
+  ASAN_POISON_MEMORY_REGION(base, size);
+#endif
+}
+
+MICROUNIT_API void ArenaResource::Unpoison(char *base, size_t size) {
+#if defined(MICROUNIT_ASAN)
+  ASAN_UNPOISON_MEMORY_REGION(base, size);
+#else
+  (void)base;
+  (void)size;
+#endif
+}
+
+MICROUNIT_API ArenaResource*& CurrentArena() {
+  static thread_local ArenaResource *arena = nullptr;
+  return arena;
+}
+#endif
+
+MICROUNIT_API ptrdiff_t RealFileIo::Read(int fd, void *buffer, size_t size) {
+#if defined(_WIN32)
+  return _read(fd, buffer, static_cast<unsigned int>(size));
+#else
+  return read(fd, buffer, size);
+#endif
+}
+
+MICROUNIT_API ptrdiff_t RealFileIo::Write(int fd, const void *buffer,
+                                          size_t size) {
+#if defined(_WIN32)
+  return _write(fd, buffer, static_cast<unsigned int>(size));
+#else
+  return write(fd, buffer, size);
+#endif
+}
+
+/**
+* @brief Registered test cases and teardown functions.
+*/
+struct UnitTester::Registry {
+  /**
+  * @brief A static test function, or a dynamic test case, which can be
+  *        parameterized (see RegisterParameterized).
+  */
+  struct Unit {
+    UnitFunction function;
+    DynamicUnit *dynamic;
+    bool parameterized;
+    size_t parameters;
+    void Run(UnitFunctionResult *result, size_t index) const {
+      if (function) {
+        function(result);
+      } else {
+        dynamic->Run(result, index);
+      }
+    }
+  };
+
+  /** @brief Fixed-size slots for the dynamic test cases. */
+  struct DynamicBlock {
+    static const size_t kSlots = 128;
+    alignas(DynamicUnit) unsigned char slots[kSlots][sizeof(DynamicUnit)];
+    size_t used{ 0 };
+  };
+
+  std::map<std::string, Unit> unitfunction_map;
+  /** @brief Names registered again; only their first test case is kept. */
+  std::vector<std::string> duplicates;
+  std::vector<void(*)()> teardown_functions;
+  std::vector<std::unique_ptr<DynamicBlock>> dynamic_blocks;
+  std::map<std::string, void(*)(ResourceLimits&)> limit_functions;
+  std::map<std::string, std::string> tags;
+
+  ~Registry() {
+    for (auto& block : dynamic_blocks) {
+      for (size_t i = 0; i < block->used; ++i) {
+        reinterpret_cast<DynamicUnit*>(block->slots[i])->~DynamicUnit();
+      }
+    }
+  }
+};
+
+MICROUNIT_API UnitTester::Registry& UnitTester::Instance() {
+  static Registry registry;
+  return registry;
+}
+
+MICROUNIT_API void UnitTester::RegisterFunction(const char *name,
+                                                UnitFunction function,
+                                                const char *type_name) {
+  const std::string full_name = type_name ?
+    std::string(name) + "<" + type_name + ">" : std::string(name);
+  if (!Instance().unitfunction_map.emplace(
+        full_name, Registry::Unit{ function, nullptr, false, 0 }).second) {
+    Instance().duplicates.push_back(full_name);
+  }
+}
+
+MICROUNIT_API void* UnitTester::AllocateDynamicUnit() {
+  auto& blocks = Instance().dynamic_blocks;
+  if (blocks.empty() || blocks.back()->used == Registry::DynamicBlock::kSlots) {
+    blocks.emplace_back(new Registry::DynamicBlock());
+  }
+  // The slot is only counted as used once it holds a constructed unit.
+  return blocks.back()->slots[blocks.back()->used];
+}
+
+MICROUNIT_API void UnitTester::RegisterDynamic(const char *name,
+                                               DynamicUnit *unit,
+                                               bool parameterized,
+                                               size_t parameters) {
+  ++Instance().dynamic_blocks.back()->used;
+  if (!Instance().unitfunction_map.emplace(
+        name, Registry::Unit{ nullptr, unit, parameterized,
+                              parameters }).second) {
+    unit->~DynamicUnit();
+    --Instance().dynamic_blocks.back()->used;
+    Instance().duplicates.push_back(name);
+  }
+}
+
+MICROUNIT_API void UnitTester::RegisterTeardown(void(*function)()) {
+  Instance().teardown_functions.push_back(function);
+}
+
+MICROUNIT_API void UnitTester::RegisterLimits(
+    const char *name, void(*function)(ResourceLimits&)) {
+  Instance().limit_functions[name] = function;
+}
+
+MICROUNIT_API void UnitTester::RegisterTags(const char *name,
+                                            const char *tags) {
+  std::string& all = Instance().tags[name];
+  if (!all.empty()) all += ",";
+  all += tags;
+}
+
+/**
+* @brief Append-only record of the completed test cases (see
+*        RunOptions::journal), so that a run killed before its end can be
+*        resumed. One line per record:
+*        "pass NAME" and "fail NAME" for a test case, and for a parameterized
+*        one, "start NAME", then "pfail NAME[index]" for each failing
+*        parameter, and "done PASSED NAME" at the end. A backslash or a
+*        newline in a name is written as "\\" or "\n". Each record is
+*        written as soon as it is known, which survives the process being
+*        killed; records are synced to disk in batches, and when the journal
+*        closes.
+*/
+class Journal {
+public:
+  /** @brief Results of a test case found in the journal. */
+  struct Entry {
+    bool done{ false };
+    bool passed{ false };
+    size_t passed_parameters{ 0 };
+    std::vector<std::string> failures;
+  };
+
+  ~Journal() {
+    Close();
+  }
+
+  /**
+  * @brief Open the journal, and read its records if resuming.
+  * @returns False if the file cannot be opened.
+  */
+  bool Open(const char *path, bool resume) {
+    const long complete_size = resume ? Load(path) : -1;
+#if defined(_WIN32)
+    fd_ = _open(path, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY |
+                (resume ? 0 : _O_TRUNC), _S_IREAD | _S_IWRITE);
+#else
+    fd_ = open(path, O_WRONLY | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC),
+               0644);
+#endif
+    last_sync_ = std::chrono::steady_clock::now();
+    // Drop a last record cut by a crash, rather than append to it.
+    if (fd_ >= 0 && complete_size >= 0) {
+#if defined(_WIN32)
+      _chsize(fd_, complete_size);
+#else
+      if (ftruncate(fd_, complete_size) != 0) return false;
+#endif
+    }
+    return fd_ >= 0;
+  }
+
+  /** @brief Recorded results of a completed test case, or null. */
+  const Entry* Find(const std::string& name) const {
+    auto entry = entries_.find(name);
+    return entry != entries_.end() && entry->second.done ?
+      &entry->second : nullptr;
+  }
+
+  /** @brief Append a record, see the class description. */
+  void Append(const char *kind, const std::string& name) {
+    if (fd_ < 0) return;
+    std::string line = kind;
+    line += ' ';
+    for (const char c : name) {
+      if (c == '\\') {
+        line += "\\\\";
+      } else if (c == '\n') {
+        line += "\\n";
+      } else {
+        line += c;
+      }
+    }
+    line += '\n';
+    Write(line.data(), line.size());
+    const auto now = std::chrono::steady_clock::now();
+    if (++unsynced_ >= kSyncRecords ||
+        now - last_sync_ >= std::chrono::seconds(kSyncSeconds)) {
+      Sync();
+      last_sync_ = now;
+    }
+  }
+
+  void Close() {
+    if (fd_ < 0) return;
+    Sync();
+#if defined(_WIN32)
+    _close(fd_);
+#else
+    close(fd_);
+#endif
+    fd_ = -1;
+  }
+
+private:
+  enum { kSyncRecords = 64, kSyncSeconds = 1 };
+
+  void Write(const char *data, size_t size) {
+    while (size > 0) {
+#if defined(_WIN32)
+      const int written = _write(fd_, data, static_cast<unsigned int>(size));
+#else
+      const ssize_t written = write(fd_, data, size);
+#endif
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+  }
+
+  void Sync() {
+    if (!unsynced_) return;
+#if defined(_WIN32)
+    _commit(fd_);
+#else
+    fsync(fd_);
+#endif
+    unsynced_ = 0;
+  }
+
+  /**
+  * @brief Read the records.
+  * @returns Size of the complete lines, or -1 if the file does not exist.
+  */
+  long Load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+    std::string line;
+    long size = 0, complete_size = 0;
+    for (int c; (c = fgetc(file)) != EOF;) {
+      ++size;
+      if (c != '\n') {
+        line += static_cast<char>(c);
+        continue;
+      }
+      // Only complete lines: the last one may have been cut by a crash.
+      Parse(line);
+      line.clear();
+      complete_size = size;
+    }
+    fclose(file);
+    return complete_size;
+  }
+
+  void Parse(const std::string& line) {
+    const size_t space = line.find(' ');
+    if (space == std::string::npos) return;
+    const std::string kind = line.substr(0, space);
+    std::string name;
+    for (size_t i = space + 1; i < line.size(); ++i) {
+      if (line[i] == '\\' && i + 1 < line.size()) {
+        name += line[++i] == 'n' ? '\n' : line[i];
+      } else {
+        name += line[i];
+      }
+    }
+    if (kind == "pass" || kind == "fail") {
+      Entry& entry = entries_[name];
+      entry.done = true;
+      entry.passed = kind == "pass";
+    } else if (kind == "pfail") {
+      // The index is the last bracket: the name itself may contain some.
+      const size_t bracket = name.rfind('[');
+      if (bracket == std::string::npos) return;
+      entries_[name.substr(0, bracket)].failures.push_back(name);
+    } else if (kind == "start") {
+      entries_[name] = Entry();
+    } else if (kind == "done") {
+      const size_t separator = name.find(' ');
+      if (separator == std::string::npos) return;
+      Entry& entry = entries_[name.substr(separator + 1)];
+      entry.done = true;
+      entry.passed_parameters = static_cast<size_t>(
+        strtoull(name.c_str(), nullptr, 10));
+    }
+  }
+
+  int fd_{ -1 };
+  size_t unsynced_{ 0 };
+  std::chrono::steady_clock::time_point last_sync_;
+  std::map<std::string, Entry> entries_;
+};
+
+/**
+* @brief Signal that asked the run to stop, or 0. Only written by the signal
+*        handler, with the async-signal-safe store to a sig_atomic_t.
+*/
+inline volatile sig_atomic_t& StopSignal() {
+  static volatile sig_atomic_t signal_number = 0;
+  return signal_number;
+}
+
+/**
+* @brief Handles SIGINT and SIGTERM while it exists (see
+*        RunOptions::handle_signals), and restores the previous handlers.
+*/
+class SignalGuard {
+public:
+  explicit SignalGuard(bool enabled) : enabled_(enabled) {
+    StopSignal() = 0;
+    if (!enabled_) return;
+    previous_interrupt_ = signal(SIGINT, &Handle);
+    previous_terminate_ = signal(SIGTERM, &Handle);
+  }
+  ~SignalGuard() {
+    if (!enabled_) return;
+    signal(SIGINT, previous_interrupt_);
+    signal(SIGTERM, previous_terminate_);
+  }
+  SignalGuard(const SignalGuard&) = delete;
+  SignalGuard& operator=(const SignalGuard&) = delete;
+
+private:
+  static void Handle(int signal_number) {
+    if (StopSignal()) {
+      // Second signal: give up on the orderly stop.
+      signal(signal_number, SIG_DFL);
+      raise(signal_number);
+      return;
+    }
+    StopSignal() = signal_number;
+  }
+
+  bool enabled_;
+  void (*previous_interrupt_)(int){ nullptr };
+  void (*previous_terminate_)(int){ nullptr };
+};
+
+/**
+* @brief Flag that cancels the runs on this thread, when set (see
+*        SelfTest::Cancel), or null.
+*/
+inline std::atomic<bool>*& CurrentCancel() {
+  static thread_local std::atomic<bool> *cancel = nullptr;
+  return cancel;
+}
+
+/** @brief Receiver of the output written on this thread, if any. */
+struct OutputRedirect {
+  OutputCallback callback;
+  void *context;
+};
+
+inline OutputRedirect& CurrentRedirect() {
+  static thread_local OutputRedirect redirect = { nullptr, nullptr };
+  return redirect;
+}
+
+inline void DiscardOutput(const char*, size_t, void*) {}
+
+/**
+* @brief What a run of a test case produced, compared by
+*        RunOptions::check_determinism: hashes of the output written on its
+*        thread and of its recorded state.
+*/
+struct Observation {
+  uint64_t output;
+  uint64_t state;
+};
+
+inline Observation*& CurrentObservation() {
+  static thread_local Observation *observation = nullptr;
+  return observation;
+}
+
+inline uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+/** @brief CPU time of the calling thread, in seconds. */
+inline double ThreadCpuSeconds() {
+#if defined(_WIN32)
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return 0;
+  }
+  const auto ticks = [](const FILETIME& time) {
+    return (static_cast<uint64_t>(time.dwHighDateTime) << 32) |
+      time.dwLowDateTime;
+  };
+  return static_cast<double>(ticks(kernel) + ticks(user)) / 1e7;
+#else
+  struct timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) return 0;
+  return static_cast<double>(time.tv_sec) +
+    static_cast<double>(time.tv_nsec) / 1e9;
+#endif
+}
+
+/** @brief Whether a comma separated list of tags has one of another list. */
+inline bool HasTag(const std::string& tags, const char *wanted) {
+  for (const char *tag = wanted; *tag;) {
+    const char *end = strchr(tag, ',');
+    if (!end) end = tag + strlen(tag);
+    const size_t size = static_cast<size_t>(end - tag);
+    for (size_t begin = 0; begin <= tags.size();) {
+      size_t next = tags.find(',', begin);
+      if (next == std::string::npos) next = tags.size();
+      if (size > 0 && next - begin == size &&
+          tags.compare(begin, size, tag, size) == 0) {
+        return true;
+      }
+      begin = next + 1;
+    }
+    tag = *end ? end + 1 : end;
+  }
+  return false;
+}
+
+/** @brief Test case, or parameters of one, selected by RunOptions::filter. */
+struct Selection {
+  bool all{ false };
+  std::vector<size_t> indices;
+};
+
+/** @brief Match the name of a test case against RunOptions::filter. */
+inline Selection Select(const char *filter, const std::string& name) {
+  Selection selection;
+  if (!filter) {
+    selection.all = true;
+    return selection;
+  }
+  for (const char *entry = filter; *entry;) {
+    const char *end = strchr(entry, ',');
+    if (!end) end = entry + strlen(entry);
+    const char *bracket = static_cast<const char*>(
+      memchr(entry, '[', static_cast<size_t>(end - entry)));
+    const char *name_end = bracket ? bracket : end;
+    size_t size = static_cast<size_t>(name_end - entry);
+    const bool prefix = size > 0 && entry[size - 1] == '*';
+    if (prefix) --size;
+    if ((prefix ? name.size() >= size : name.size() == size) &&
+        name.compare(0, size, entry, size) == 0) {
+      if (!bracket) {
+        selection.all = true;
+      } else {
+        selection.indices.push_back(
+          static_cast<size_t>(strtoull(bracket + 1, nullptr, 10)));
+      }
+    }
+    entry = *end ? end + 1 : end;
+  }
+  return selection;
+}
+
+/** @brief Scratch directory of the running test case. */
+struct Scratch {
+  const char *root{ nullptr };
+  std::string path;
+};
+
+inline Scratch& CurrentScratch() {
+  static Scratch scratch;
+  return scratch;
+}
+
+#if !defined(_WIN32)
+/**
+* @brief Add up the sizes of the files under a directory, and remove them,
+*        and the directory, if asked to.
+*/
+inline size_t WalkDirectory(const std::string& path, bool remove) {
+  size_t size = 0;
+  if (DIR *directory = opendir(path.c_str())) {
+    while (struct dirent *entry = readdir(directory)) {
+      if (strcmp(entry->d_name, ".") == 0 ||
+          strcmp(entry->d_name, "..") == 0) {
+        continue;
+      }
+      const std::string child = path + "/" + entry->d_name;
+      struct stat status;
+      if (lstat(child.c_str(), &status) != 0) continue;
+      if (S_ISDIR(status.st_mode)) {
+        size += WalkDirectory(child, remove);
+      } else {
+        size += static_cast<size_t>(status.st_size);
+        if (remove) unlink(child.c_str());
+      }
+    }
+    closedir(directory);
+  }
+  if (remove) rmdir(path.c_str());
+  return size;
+}
+#endif
+
+MICROUNIT_API const char* ScratchDirectory() {
+#if defined(_WIN32)
+  return nullptr;
+#else
+  Scratch& scratch = CurrentScratch();
+  if (scratch.path.empty()) {
+    const char *root = scratch.root;
+    if (!root) root = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : nullptr;
+    if (!root) root = getenv("TMPDIR");
+    if (!root) root = "/tmp";
+    std::string path = std::string(root) + "/microunit-XXXXXX";
+    if (!mkdtemp(&path[0])) return nullptr;
+    scratch.path = path;
+  }
+  return scratch.path.c_str();
+#endif
+}
+
+/**
+* @brief Check the scratch directory of a test case against the quota, and
+*        remove it if the test case passed.
+* @returns Whether the test case passed and kept within the quota.
+*/
+inline bool CloseScratch(bool success, size_t quota) {
+#if !defined(_WIN32)
+  Scratch& scratch = CurrentScratch();
+  if (scratch.path.empty()) return success;
+  if (quota) {
+    const size_t size = WalkDirectory(scratch.path, false);
+    if (size > quota) {
+      TERMINAL_BAD << "The scratch directory holds " << size
+        << " bytes, over the quota of " << quota << " bytes";
+      success = false;
+    }
+  }
+  if (success) {
+    WalkDirectory(scratch.path, true);
+  } else {
+    TERMINAL_INFO << "Kept the scratch directory "
+      << scratch.path.c_str();
+  }
+  scratch.path.clear();
+#else
+  (void)quota;
+#endif
+  return success;
+}
+
+/** @brief Value of a "name: value" line of a /proc file, or 0. */
+inline uint64_t ProcField(const char *text, const char *name) {
+  const char *line = strstr(text, name);
+  if (!line) return 0;
+  line += strlen(name);
+  while (*line == ':' || *line == ' ' || *line == '\t') ++line;
+  return strtoull(line, nullptr, 10);
+}
+
+/** @brief Read syscalls made, and bytes read, by ReadProcFile. */
+struct ProcReads {
+  uint64_t syscalls;
+  uint64_t bytes;
+};
+
+inline ProcReads& OwnReads() {
+  static ProcReads reads = { 0, 0 };
+  return reads;
+}
+
+/** @brief Read a small /proc file with a single read syscall. */
+inline bool ReadProcFile(const char *path, char *buffer, size_t size) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  const ssize_t length = read(fd, buffer, size - 1);
+  close(fd);
+  ++OwnReads().syscalls;
+  if (length <= 0) return false;
+  OwnReads().bytes += static_cast<uint64_t>(length);
+  buffer[length] = '\0';
+  return true;
+}
+
+/** @brief Current I/O counters of the process. */
+inline IoCounters ProcessIo() {
+  IoCounters counters;
+#if defined(__linux__)
+  char buffer[4096];
+  if (ReadProcFile("/proc/self/io", buffer, sizeof(buffer))) {
+    counters.read_bytes = ProcField(buffer, "rchar");
+    counters.write_bytes = ProcField(buffer, "wchar");
+    counters.read_syscalls = ProcField(buffer, "syscr");
+    counters.write_syscalls = ProcField(buffer, "syscw");
+    counters.storage_read_bytes = ProcField(buffer, "\nread_bytes");
+    counters.storage_write_bytes = ProcField(buffer, "\nwrite_bytes");
+  }
+  if (ReadProcFile("/proc/self/status", buffer, sizeof(buffer))) {
+    counters.voluntary_switches =
+      ProcField(buffer, "\nvoluntary_ctxt_switches");
+    counters.involuntary_switches =
+      ProcField(buffer, "nonvoluntary_ctxt_switches");
+  }
+#endif
+  return counters;
+}
+
+/**
+* @brief Counters from one reading to another, less the given read syscalls
+*        and bytes, for each counter, at least 0.
+*/
+inline IoCounters IoDifference(const IoCounters& to, const IoCounters& from,
+                               uint64_t syscalls, uint64_t bytes) {
+  auto difference = [](uint64_t end, uint64_t start, uint64_t less) {
+    return end > start + less ? end - start - less : 0;
+  };
+  IoCounters counters;
+  counters.read_bytes = difference(to.read_bytes, from.read_bytes, bytes);
+  counters.write_bytes = difference(to.write_bytes, from.write_bytes, 0);
+  counters.read_syscalls = difference(to.read_syscalls, from.read_syscalls,
+                                      syscalls);
+  counters.write_syscalls = difference(to.write_syscalls,
+                                       from.write_syscalls, 0);
+  counters.storage_read_bytes = difference(to.storage_read_bytes,
+                                           from.storage_read_bytes, 0);
+  counters.storage_write_bytes = difference(to.storage_write_bytes,
+                                            from.storage_write_bytes, 0);
+  counters.voluntary_switches = difference(to.voluntary_switches,
+                                           from.voluntary_switches, 0);
+  counters.involuntary_switches = difference(to.involuntary_switches,
+                                             from.involuntary_switches, 0);
+  return counters;
+}
+
+// A reading of the counters only includes the reads of the /proc files
+// that completed before it, which are left out of the difference.
+MICROUNIT_API IoMeter::IoMeter() {
+  own_syscalls_ = OwnReads().syscalls;
+  own_bytes_ = OwnReads().bytes;
+  start_ = ProcessIo();
+}
+
+MICROUNIT_API IoCounters IoMeter::Counters() {
+  const ProcReads own = OwnReads();
+  const IoCounters now = ProcessIo();
+  return IoDifference(now, start_, own.syscalls - own_syscalls_,
+                      own.bytes - own_bytes_);
+}
+
+/** @brief Log the I/O counters of a test case. */
+inline void LogIo(const IoCounters& io) {
+  TERMINAL_INFO << "I/O: read " << io.read_bytes << " bytes in "
+    << io.read_syscalls << " syscalls, wrote " << io.write_bytes
+    << " bytes in " << io.write_syscalls << " syscalls, storage "
+    << io.storage_read_bytes << "/" << io.storage_write_bytes
+    << " bytes, " << io.voluntary_switches << "/"
+    << io.involuntary_switches << " context switches";
+}
+
+#if defined(MICROUNIT_HAS_SYSCALL_TRACE)
+/** @brief Name of a syscall number, for the common ones. */
+inline const char* SyscallName(long number) {
+  static const struct {
+    long number;
+    const char *name;
+  } names[] = {
+    { SYS_read, "read" }, { SYS_write, "write" },
+    { SYS_pread64, "pread64" }, { SYS_pwrite64, "pwrite64" },
+    { SYS_readv, "readv" }, { SYS_writev, "writev" },
+    { SYS_openat, "openat" }, { SYS_close, "close" },
+    { SYS_fstat, "fstat" }, { SYS_newfstatat, "newfstatat" },
+    { SYS_lseek, "lseek" }, { SYS_fsync, "fsync" },
+    { SYS_fdatasync, "fdatasync" }, { SYS_getdents64, "getdents64" },
+    { SYS_ioctl, "ioctl" }, { SYS_fcntl, "fcntl" },
+    { SYS_mmap, "mmap" }, { SYS_munmap, "munmap" },
+    { SYS_mprotect, "mprotect" }, { SYS_brk, "brk" },
+    { SYS_futex, "futex" }, { SYS_ppoll, "ppoll" },
+    { SYS_clock_gettime, "clock_gettime" }, { SYS_nanosleep, "nanosleep" },
+    { SYS_rt_sigaction, "rt_sigaction" },
+    { SYS_rt_sigprocmask, "rt_sigprocmask" },
+    { SYS_getpid, "getpid" }, { SYS_sched_yield, "sched_yield" },
+    { SYS_exit_group, "exit_group" },
+  };
+  for (const auto& entry : names) {
+    if (entry.number == number) return entry.name;
+  }
+  return nullptr;
+}
+
+/**
+* @brief Follow a child that stopped itself after PTRACE_TRACEME, and the
+*        threads it starts, count their syscalls by number, and return when
+*        the whole child has ended.
+*/
+inline void TraceSyscalls(pid_t child, int *status,
+                          std::map<long, size_t> *counts) {
+  while (waitpid(child, status, __WALL) < 0 && errno == EINTR) {}
+  if (!WIFSTOPPED(*status)) return;
+  ptrace(PTRACE_SETOPTIONS, child, nullptr,
+         reinterpret_cast<void*>(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL |
+                                 PTRACE_O_TRACECLONE));
+  // The initial SIGSTOP of the child and of each new thread is not
+  // delivered; other signals are. The child is the only child of this
+  // process while it runs, so waiting for any thread only sees its threads.
+  std::set<pid_t> threads{ child };
+  ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+  for (;;) {
+    int thread_status = 0;
+    const pid_t thread = waitpid(-1, &thread_status, __WALL);
+    if (thread < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (!WIFSTOPPED(thread_status)) {
+      // The leader is reported last, once all the other threads are gone.
+      if (thread == child) {
+        *status = thread_status;
+        return;
+      }
+      threads.erase(thread);
+      continue;
+    }
+    intptr_t signal_number = WSTOPSIG(thread_status);
+    if (threads.insert(thread).second && signal_number == SIGSTOP) {
+      signal_number = 0;
+    } else if (signal_number == (SIGTRAP | 0x80)) {
+      signal_number = 0;
+      struct __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, thread,
+                 reinterpret_cast<void*>(sizeof(info)), &info) > 0 &&
+          info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        ++(*counts)[static_cast<long>(info.entry.nr)];
+      }
+    } else if (signal_number == SIGTRAP && (thread_status >> 16) != 0) {
+      // A new thread, PTRACE_EVENT_CLONE.
+      signal_number = 0;
+    }
+    ptrace(PTRACE_SYSCALL, thread, nullptr,
+           reinterpret_cast<void*>(signal_number));
+  }
+}
+
+/** @brief Log the syscall counts of a test case, most frequent first. */
+inline void LogSyscalls(const std::map<long, size_t>& counts) {
+  std::vector<std::pair<size_t, long>> sorted;
+  for (const auto& count : counts) {
+    sorted.emplace_back(count.second, count.first);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<size_t, long>& a,
+               const std::pair<size_t, long>& b) {
+              return a.first > b.first;
+            });
+  std::string text;
+  for (const auto& count : sorted) {
+    if (!text.empty()) text += ", ";
+    const char *name = SyscallName(count.second);
+    text += name ? name : "#" + std::to_string(count.second);
+    text += " " + std::to_string(count.first);
+  }
+  TERMINAL_INFO << "Syscalls: " << (text.empty() ? "none" : text.c_str());
+}
+#endif
+
+inline uint64_t& CurrentSeed() {
+  static uint64_t seed = 0;
+  return seed;
+}
+
+MICROUNIT_API uint64_t TestSeed() {
+  return CurrentSeed();
+}
+
+MICROUNIT_API void RecordState(const void *data, size_t size) {
+  Observation *observation = CurrentObservation();
+  if (observation) {
+    observation->state = HashBytes(observation->state, data, size);
+  }
+}
+
+/** @brief Seed of a test case: a hash of its name and index, and the run. */
+inline uint64_t MakeSeed(uint64_t run_seed, const std::string& name,
+                         size_t index) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (const char c : name) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+  }
+  hash ^= (index + 1) * 0x9E3779B97F4A7C15ull + run_seed;
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+  return hash ^ (hash >> 31);
+}
+
+/**
+* @brief Painted stack on which test cases run when RunOptions::stack_size is
+*        set. The bytes that are no longer the paint give the high-water
+*        mark, less what an empty test case uses (the thread's own data).
+*/
+class TestStack {
+public:
+  explicit TestStack(size_t size) {
+#if !defined(_WIN32)
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (size < static_cast<size_t>(PTHREAD_STACK_MIN)) {
+      size = PTHREAD_STACK_MIN;
+    }
+    size = (size + page - 1) / page * page;
+    void *memory = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return;
+    mprotect(memory, page, PROT_NONE);
+    memory_ = memory;
+    mapped_ = size + page;
+    low_ = static_cast<unsigned char*>(memory) + page;
+    size_ = size;
+    Current() = this;
+    Run([]() {});
+    baseline_ = Used();
+#else
+    (void)size;
+#endif
+  }
+  ~TestStack() {
+#if !defined(_WIN32)
+    if (memory_) munmap(memory_, mapped_);
+#endif
+    if (Current() == this) Current() = nullptr;
+  }
+  TestStack(const TestStack&) = delete;
+  TestStack& operator=(const TestStack&) = delete;
+
+  /** @brief Stack of the test case that is running, or null. */
+  static TestStack*& Current() {
+    static TestStack *stack = nullptr;
+    return stack;
+  }
+
+  /**
+  * @brief Run a function on a thread with the painted stack, or on the
+  *        calling thread if there is none.
+  * @returns Bytes of stack that the function used.
+  */
+  template <typename Function>
+  size_t Run(Function function) {
+#if !defined(_WIN32)
+    if (low_) {
+      memset(low_, kPaint, size_);
+      pthread_attr_t attributes;
+      pthread_attr_init(&attributes);
+      pthread_attr_setstack(&attributes, low_, size_);
+      pthread_t thread;
+      const bool started = pthread_create(&thread, &attributes,
+        &Call<Function>, &function) == 0;
+      pthread_attr_destroy(&attributes);
+      if (started) {
+        pthread_join(thread, nullptr);
+        return HighWater();
+      }
+    }
+#endif
+    function();
+    return 0;
+  }
+
+  /** @brief Bytes used so far by the function on the painted stack. */
+  size_t HighWater() const {
+    const size_t used = Used();
+    return used > baseline_ ? used - baseline_ : 0;
+  }
+
+private:
+  enum { kPaint = 0xA5 };
+
+  template <typename Function>
+  static void* Call(void *function) {
+    (*static_cast<Function*>(function))();
+    return nullptr;
+  }
+
+  // The stack grows down, so the lowest byte that was written is the
+  // deepest one.
+  size_t Used() const {
+    size_t unused = 0;
+    while (unused < size_ && low_[unused] == kPaint) ++unused;
+    return size_ - unused;
+  }
+
+  void *memory_{ nullptr };
+  size_t mapped_{ 0 };
+  unsigned char *low_{ nullptr };
+  size_t size_{ 0 };
+  size_t baseline_{ 0 };
+};
+
+MICROUNIT_API size_t StackHighWater() {
+  return TestStack::Current() ? TestStack::Current()->HighWater() : 0;
+}
+
+/**
+* @brief Pins the calling thread to the CPUs of a NUMA node (see
+*        RunOptions::numa_node) until destroyed. The threads and processes
+*        that it starts meanwhile inherit the pinning.
+*/
+class NodePinning {
+public:
+  explicit NodePinning(int node) {
+#if defined(__linux__)
+    if (node < 0) return;
+    // The CPUs of the node, as a list of ranges such as "0-15,32-47".
+    char path[64], list[1024];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (ReadProcFile(path, list, sizeof(list))) {
+      for (char *range = list; *range >= '0' && *range <= '9';) {
+        const long first = strtol(range, &range, 10);
+        const long last = *range == '-' ? strtol(range + 1, &range, 10) :
+          first;
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+          CPU_SET(static_cast<int>(cpu), &cpus);
+        }
+        if (*range == ',') ++range;
+      }
+    }
+    pinned_ = CPU_COUNT(&cpus) != 0 &&
+      sched_getaffinity(0, sizeof(previous_), &previous_) == 0 &&
+      sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+    if (!pinned_) {
+      TERMINAL_BAD << "Cannot run on the CPUs of NUMA node " << node;
+    }
+#else
+    if (node >= 0) {
+      TERMINAL_BAD << "Cannot run on the CPUs of NUMA node " << node;
+    }
+#endif
+  }
+
+  ~NodePinning() {
+#if defined(__linux__)
+    if (pinned_) sched_setaffinity(0, sizeof(previous_), &previous_);
+#endif
+  }
+
+  NodePinning(const NodePinning&) = delete;
+  NodePinning& operator=(const NodePinning&) = delete;
+
+private:
+#if defined(__linux__)
+  cpu_set_t previous_;
+#endif
+  bool pinned_{ false };
+};
+
+/** @brief NUMA node and CPU that a thread runs on, or -1 if unknown. */
+struct Placement {
+  int node;
+  int cpu;
+};
+
+inline Placement CurrentPlacement() {
+  Placement placement = { -1, -1 };
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+    placement.node = static_cast<int>(node);
+    placement.cpu = static_cast<int>(cpu);
+  }
+#endif
+  return placement;
+}
+
+/** @brief Threads and file descriptors of the process (see detect_leaks). */
+struct ProcessResources {
+  std::map<long, std::string> threads;
+  std::map<int, std::string> fds;
+};
+
+/** @brief Current threads, by id with their name, and file descriptors. */
+inline ProcessResources ListResources() {
+  ProcessResources resources;
+#if defined(__linux__)
+  if (DIR *tasks = opendir("/proc/self/task")) {
+    while (struct dirent *entry = readdir(tasks)) {
+      if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+      const std::string comm = std::string("/proc/self/task/") +
+        entry->d_name + "/comm";
+      char name[64] = "";
+      if (ReadProcFile(comm.c_str(), name, sizeof(name))) {
+        name[strcspn(name, "\n")] = '\0';
+      }
+      resources.threads[strtol(entry->d_name, nullptr, 10)] = name;
+    }
+    closedir(tasks);
+  }
+  if (DIR *fds = opendir("/proc/self/fd")) {
+    while (struct dirent *entry = readdir(fds)) {
+      if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+      const int fd = atoi(entry->d_name);
+      if (fd == dirfd(fds)) continue;
+      char target[512];
+      const ssize_t length = readlink(
+        (std::string("/proc/self/fd/") + entry->d_name).c_str(), target,
+        sizeof(target) - 1);
+      target[length > 0 ? length : 0] = '\0';
+      resources.fds[fd] = target;
+    }
+    closedir(fds);
+  }
+#endif
+  return resources;
+}
+
+/**
+* @brief Log the threads and file descriptors in after that were not in
+*        before, and tell whether there are any.
+*/
+inline bool ReportLeaks(const ProcessResources& before,
+                        const ProcessResources& after) {
+  bool leaked = false;
+  for (const auto& thread : after.threads) {
+    if (before.threads.count(thread.first)) continue;
+    TERMINAL_BAD << "Leaked thread " << thread.first << " '"
+      << thread.second.c_str() << "'";
+    leaked = true;
+  }
+  for (const auto& fd : after.fds) {
+    auto previous = before.fds.find(fd.first);
+    if (previous != before.fds.end() && previous->second == fd.second) {
+      continue;
+    }
+    TERMINAL_BAD << "Leaked file descriptor " << fd.first << " to "
+      << fd.second.c_str();
+    leaked = true;
+  }
+  return leaked;
+}
+
+/** @brief How a test case ended. */
+enum class TestOutcome {
+  kPassed,
+  kFailed,
+  kCrashed,
+  kCpuLimit,
+  kMemoryLimit,
+  kOpenFileLimit,
+  kOutputLimit,
+  kNondeterministic,
+  kStopped
+};
+
+/** @brief Short description of an outcome. */
+inline const char* OutcomeName(TestOutcome outcome) {
+  switch (outcome) {
+  case TestOutcome::kPassed: return "passed";
+  case TestOutcome::kFailed: return "failed";
+  case TestOutcome::kCrashed: return "crashed";
+  case TestOutcome::kCpuLimit: return "CPU time limit";
+  case TestOutcome::kMemoryLimit: return "address space limit";
+  case TestOutcome::kOpenFileLimit: return "open file limit";
+  case TestOutcome::kOutputLimit: return "output size limit";
+  case TestOutcome::kNondeterministic: return "nondeterministic";
+  default: return "stopped";
+  }
+}
+
+/**
+* @brief Name of a failed test case in the summary, with the reason for the
+*        failures that are not assertions.
+*/
+inline std::string FailureName(const std::string& name, TestOutcome outcome) {
+  if (outcome == TestOutcome::kFailed) return name;
+  return name + " (" + OutcomeName(outcome) + ")";
+}
+
+/** @brief Flush the output buffered in this process, before a fork. */
+inline void FlushOutput() {
+#if defined(MICROUNIT_STREAMS)
+  std::cout.flush();
+#endif
+  fflush(stdout);
+  fflush(stderr);
+}
+
+#if !defined(_WIN32)
+/** @brief Exit codes of an isolated test case that hit a limit. */
+enum { kExitOutOfMemory = 125, kExitOutOfFiles = 124 };
+
+inline void SetLimit(int resource, rlim_t soft, rlim_t hard) {
+  if (soft == 0) return;
+  struct rlimit limit;
+  limit.rlim_cur = soft;
+  limit.rlim_max = hard;
+  setrlimit(resource, &limit);
+}
+
+/**
+* @brief Whether an allocation failed in an isolated test case with an
+*        address space limit.
+*/
+inline bool& OutOfMemory() {
+  static bool out_of_memory = false;
+  return out_of_memory;
+}
+
+// The test case can still catch the std::bad_alloc; only when it does not
+// (or fails) is the limit blamed.
+inline void ThrowOutOfMemory() {
+  OutOfMemory() = true;
+  throw std::bad_alloc();
+}
+
+inline void TerminateOutOfMemory() {
+  if (OutOfMemory()) _exit(kExitOutOfMemory);
+  abort();
+}
+
+/** @brief CPU time used by the children that were waited for, in seconds. */
+inline double ChildrenCpuSeconds() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_CHILDREN, &usage) != 0) return 0;
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+    static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+    1e6;
+}
+
+/**
+* @brief Run a test case in a child process with the given resource limits,
+*        forward its output, and tell how it ended. The child is killed if
+*        the run is stopped by a signal (see RunOptions::handle_signals).
+* @param [in] run  Runs the test case, and returns whether it passed.
+* @param [in] trace  Log the syscalls of the child, where supported.
+*/
+template <typename Function>
+TestOutcome RunIsolated(Function run, const ResourceLimits& limits,
+                        bool trace) {
+  int fds[2];
+  FlushOutput();
+  const double cpu_before = limits.cpu_seconds ? ChildrenCpuSeconds() : 0;
+  pid_t child = -1;
+  if (pipe(fds) == 0) {
+    child = fork();
+    if (child < 0) {
+      close(fds[0]);
+      close(fds[1]);
+    }
+  }
+  if (child < 0) {
+    TERMINAL_BAD << "Cannot start a child process: " << strerror(errno);
+    return TestOutcome::kCrashed;
+  }
+
+  if (child == 0) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(fds[0]);
+    dup2(fds[1], 1);
+    dup2(fds[1], 2);
+    close(fds[1]);
+    // The hard CPU limit is one second later, so that SIGXCPU comes first.
+    SetLimit(RLIMIT_CPU, limits.cpu_seconds, limits.cpu_seconds + 1);
+    SetLimit(RLIMIT_AS, limits.address_space, limits.address_space);
+    SetLimit(RLIMIT_NOFILE, limits.open_files, limits.open_files);
+    SetLimit(RLIMIT_FSIZE, limits.output_bytes, limits.output_bytes);
+    if (limits.address_space) {
+      std::set_new_handler(&ThrowOutOfMemory);
+      std::set_terminate(&TerminateOutOfMemory);
+    }
+#if defined(MICROUNIT_HAS_SYSCALL_TRACE)
+    if (trace && ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) == 0) {
+      raise(SIGSTOP);
+    }
+#endif
+    errno = 0;
+    int code = run() ? 0 : 1;
+    if (code != 0 && limits.open_files && errno == EMFILE) {
+      code = kExitOutOfFiles;
+    } else if (code != 0 && OutOfMemory()) {
+      code = kExitOutOfMemory;
+    }
+    FlushOutput();
+    _exit(code);
+  }
+
+  // Forward the output of the child, up to the output limit, on another
+  // thread, while this one waits for the child (and traces it). The output
+  // is drained until the child ends and the pipe has been idle for a poll.
+  close(fds[1]);
+  bool stopped = false, over_output = false;
+  std::atomic<bool> exited{ false };
+  const OutputRedirect redirect = CurrentRedirect();
+  std::thread forwarder([&]() {
+    CurrentRedirect() = redirect;
+    size_t output = 0;
+    char buffer[4096];
+    for (;;) {
+      struct pollfd poll_fd = { fds[0], POLLIN, 0 };
+      const int ready = poll(&poll_fd, 1, 100);
+      if (StopSignal() && !stopped) {
+        kill(child, SIGKILL);
+        stopped = true;
+      }
+      if (ready < 0 && errno != EINTR) break;
+      if (ready == 0 && exited) break;
+      if (ready <= 0) continue;
+      const ssize_t size = read(fds[0], buffer, sizeof(buffer));
+      if (size < 0 && errno == EINTR) continue;
+      if (size <= 0) break;
+      size_t forward = static_cast<size_t>(size);
+      if (limits.output_bytes && output + forward > limits.output_bytes) {
+        forward = output < limits.output_bytes ?
+          limits.output_bytes - output : 0;
+        if (!over_output) kill(child, SIGKILL);
+        over_output = true;
+      }
+      WriteOutput(buffer, forward);
+      output += forward;
+    }
+    close(fds[0]);
+  });
+  int status = 0;
+#if defined(MICROUNIT_HAS_SYSCALL_TRACE)
+  std::map<long, size_t> syscalls;
+  if (trace) {
+    TraceSyscalls(child, &status, &syscalls);
+  } else {
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR) {}
+  }
+#else
+  (void)trace;
+  while (waitpid(child, &status, 0) < 0 && errno == EINTR) {}
+#endif
+  exited = true;
+  forwarder.join();
+#if defined(MICROUNIT_HAS_SYSCALL_TRACE)
+  if (trace && !stopped) LogSyscalls(syscalls);
+#endif
+
+  if (stopped) return TestOutcome::kStopped;
+  if (over_output) {
+    WriteOutput("\n", 1);
+    TERMINAL_BAD << "Exceeded the output limit of " << limits.output_bytes
+      << " bytes";
+    return TestOutcome::kOutputLimit;
+  }
+  if (WIFEXITED(status)) {
+    const int code = WEXITSTATUS(status);
+    if (code == 0) return TestOutcome::kPassed;
+    if (code == kExitOutOfMemory && limits.address_space) {
+      TERMINAL_BAD << "Exceeded the address space limit of "
+        << limits.address_space << " bytes";
+      return TestOutcome::kMemoryLimit;
+    }
+    if (code == kExitOutOfFiles && limits.open_files) {
+      TERMINAL_BAD << "Exceeded the limit of " << limits.open_files
+        << " open files";
+      return TestOutcome::kOpenFileLimit;
+    }
+    return TestOutcome::kFailed;
+  }
+  // A SIGKILL is only the hard CPU limit if the child used that much CPU
+  // time; otherwise it came from elsewhere, e.g. the OOM killer.
+  const int signal_number = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+  if (signal_number == SIGXCPU ||
+      (signal_number == SIGKILL && limits.cpu_seconds &&
+       ChildrenCpuSeconds() - cpu_before >=
+         static_cast<double>(limits.cpu_seconds + 1))) {
+    TERMINAL_BAD << "Exceeded the CPU time limit of " << limits.cpu_seconds
+      << " seconds";
+    return TestOutcome::kCpuLimit;
+  }
+  if (signal_number == SIGXFSZ) {
+    TERMINAL_BAD << "Exceeded the file size limit of " << limits.output_bytes
+      << " bytes";
+    return TestOutcome::kOutputLimit;
+  }
+  TERMINAL_BAD << "Crashed with signal " << signal_number;
+  return TestOutcome::kCrashed;
+}
+#else
+template <typename Function>
+TestOutcome RunIsolated(Function run, const ResourceLimits&, bool) {
+  return run() ? TestOutcome::kPassed : TestOutcome::kFailed;
+}
+#endif
+
+/**
+* @brief Log how the two runs of a test case differ (see
+*        RunOptions::check_determinism), and tell whether they do.
+*/
+inline bool ReportDifferences(TestOutcome first_outcome,
+                              TestOutcome second_outcome,
+                              const Observation& first,
+                              const Observation& second) {
+  bool differ = false;
+  if (first_outcome != second_outcome) {
+    TERMINAL_BAD << "Nondeterministic outcome: "
+      << OutcomeName(first_outcome) << ", then "
+      << OutcomeName(second_outcome);
+    differ = true;
+  }
+  if (first.output != second.output) {
+    TERMINAL_BAD << "Nondeterministic output: the second run wrote "
+      "different output";
+    differ = true;
+  }
+  if (first.state != second.state) {
+    TERMINAL_BAD << "Nondeterministic state: the second run recorded a "
+      "different state";
+    differ = true;
+  }
+  return differ;
+}
+
+MICROUNIT_API bool UnitTester::Run(const RunOptions& options) {
+  std::vector<std::string> failures, sucesses;
+  size_t test_count = 0, passed_count = 0, journaled_count = 0, ran_count = 0;
+  SignalGuard signal_guard(options.handle_signals);
+  NodePinning node_pinning(options.numa_node);
+  Journal journal;
+  if (options.journal && !journal.Open(options.journal, options.resume)) {
+    TERMINAL_BAD << "Cannot open the journal '" << options.journal << "'";
+    return false;
+  }
+#if defined(MICROUNIT_HAS_PMR)
+  std::unique_ptr<ArenaResource> arena;
+  if (options.arena) {
+    arena.reset(new ArenaResource(options.arena_options));
+  }
+  CurrentArena() = arena.get();
+#endif
+  CurrentScratch().root = options.scratch_root;
+
+  // Select the work items: a test case, or (test case, index) pairs for the
+  // parameterized ones, which are only expanded as they run. Test cases
+  // completed in a resumed journal only report their recorded results.
+  typedef std::map<std::string, Registry::Unit>::value_type Entry;
+  struct WorkItem {
+    Entry *unit;
+    Selection selection;
+    const Journal::Entry *journaled;
+  };
+  std::vector<WorkItem> selected;
+  for (auto& unit : Instance().unitfunction_map) {
+    if (options.tags) {
+      auto tags = Instance().tags.find(unit.first);
+      if (tags == Instance().tags.end() ||
+          !HasTag(tags->second, options.tags)) {
+        continue;
+      }
+    }
+    Selection selection = Select(options.filter, unit.first);
+    const size_t parameters = unit.second.parameterized ?
+      unit.second.parameters : 1;
+    if (!selection.all) {
+      auto& indices = selection.indices;
+      indices.erase(std::remove_if(indices.begin(), indices.end(),
+        [&](size_t index) {
+          return !unit.second.parameterized || index >= parameters;
+        }), indices.end());
+      if (indices.empty()) continue;
+    }
+    const Journal::Entry *journaled = options.resume && selection.all ?
+      journal.Find(unit.first) : nullptr;
+    if (journaled) {
+      journaled_count += unit.second.parameterized ?
+        journaled->passed_parameters + journaled->failures.size() : 1;
+    } else {
+      test_count += selection.all ? parameters : selection.indices.size();
+    }
+    selected.push_back(WorkItem{ &unit, std::move(selection), journaled });
+  }
+
+  if (options.resume) {
+    TERMINAL_INFO << "Resuming after " << journaled_count
+      << " test cases recorded in the journal";
+  }
+  TERMINAL_INFO
+    << "Will run " << test_count
+    << " test cases";
+  for (const auto& duplicate : Instance().duplicates) {
+    TERMINAL_BAD << "Test case '" << duplicate.c_str()
+      << "' is registered more than once, only the first one runs";
+    failures.push_back(duplicate + " (duplicate name)");
+  }
+  Notify(&Listener::OnRunStart, &PolicyHooks::on_run_start, [&]() {
+    return RunEvent{ test_count, 0 };
+  });
+
+  // Run one work item, in this process or in a child, and tell how it
+  // ended.
+  std::unique_ptr<TestStack> stack;
+  if (options.stack_size) stack.reset(new TestStack(options.stack_size));
+  auto run_unit = [&](const Registry::Unit& unit, size_t index,
+                      Observation *observation) {
+    UnitFunctionResult result;
+    const OutputRedirect redirect = CurrentRedirect();
+    Placement placement = { -1, -1 };
+    auto run = [&]() {
+      // The thread-local state of the run, on the thread of the stack.
+      CurrentRedirect() = redirect;
+#if defined(MICROUNIT_HAS_PMR)
+      CurrentArena() = arena.get();
+#endif
+      if (options.report_io) {
+        IoMeter io;
+        CurrentObservation() = observation;
+        unit.Run(&result, index);
+        CurrentObservation() = nullptr;
+        LogIo(io.Counters());
+      } else {
+        CurrentObservation() = observation;
+        unit.Run(&result, index);
+        CurrentObservation() = nullptr;
+      }
+      if (options.numa_node >= 0) placement = CurrentPlacement();
+    };
+    ProcessResources resources;
+    if (options.detect_leaks) resources = ListResources();
+    if (stack) {
+      const size_t used = stack->Run(run);
+      TERMINAL_INFO << "Stack: used " << used << " of "
+        << options.stack_size << " bytes";
+    } else {
+      run();
+    }
+    if (options.numa_node >= 0) {
+      TERMINAL_INFO << "Ran on NUMA node " << placement.node << ", CPU "
+        << placement.cpu;
+    }
+    if (options.detect_leaks &&
+        ReportLeaks(resources, ListResources()) && options.fail_leaks) {
+      result.success = false;
+    }
+    result.success = CloseScratch(result.success, options.scratch_quota);
+#if defined(MICROUNIT_HAS_PMR)
+    if (arena) {
+      const size_t leaked = arena->Reset();
+      if (leaked && options.arena_options.report_leaks) {
+        TERMINAL_INFO << leaked << " bytes allocated from the test arena "
+          "were never deallocated";
+      }
+    }
+#endif
+    return result.success;
+  };
+  const auto& limit_functions = Instance().limit_functions;
+  auto run_once = [&](const Entry& unit, size_t index,
+                      Observation *observation) {
+    if (observation) *observation = Observation{ 0xCBF29CE484222325ull,
+                                                 0xCBF29CE484222325ull };
+    CurrentSeed() = MakeSeed(options.seed, unit.first, index);
+    if (!options.isolate) {
+      return run_unit(unit.second, index, observation) ?
+        TestOutcome::kPassed : TestOutcome::kFailed;
+    }
+    ResourceLimits limits = options.limits;
+    auto limit_function = limit_functions.find(unit.first);
+    if (limit_function != limit_functions.end()) {
+      limit_function->second(limits);
+    }
+    return RunIsolated([&]() {
+      return run_unit(unit.second, index, observation);
+    }, limits, options.trace_syscalls);
+  };
+
+  // An isolated test case records what it observed in memory shared with
+  // its child process.
+  Observation local_observation;
+  Observation *observed = &local_observation;
+#if !defined(_WIN32)
+  void *shared = MAP_FAILED;
+  if (options.check_determinism && options.isolate) {
+    shared = mmap(nullptr, sizeof(Observation), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared != MAP_FAILED) observed = static_cast<Observation*>(shared);
+  }
+#endif
+  auto run_item = [&](const Entry& unit, const char *name, size_t index) {
+    Listeners().test_name = name;
+    Notify(&Listener::OnTestStart, &PolicyHooks::on_test_start, [&]() {
+      return TestEvent{ name, true };
+    });
+
+    // Run the unit test
+    HoldSharedFixtures() = options.check_determinism;
+    TestOutcome outcome = run_once(unit, index,
+                                   options.check_determinism ? observed :
+                                   nullptr);
+    HoldSharedFixtures() = false;
+    if (options.check_determinism && outcome != TestOutcome::kStopped) {
+      // Run it again, without output or events, and compare.
+      const Observation first = *observed;
+      const OutputRedirect redirect = CurrentRedirect();
+      const ListenerList listeners = Listeners();
+      CurrentRedirect() = OutputRedirect{ &DiscardOutput, nullptr };
+      Listeners().size = 0;
+      Listeners().policy = nullptr;
+      const TestOutcome second = run_once(unit, index, observed);
+      Listeners() = listeners;
+      CurrentRedirect() = redirect;
+      if (second == TestOutcome::kStopped) {
+        outcome = second;
+      } else if (ReportDifferences(outcome, second, first, *observed)) {
+        outcome = TestOutcome::kNondeterministic;
+      }
+    }
+    if (outcome != TestOutcome::kStopped) ++ran_count;
+    Notify(&Listener::OnTestEnd, &PolicyHooks::on_test_end, [&]() {
+      return TestEvent{ name, outcome == TestOutcome::kPassed };
+    });
+    return outcome;
+  };
+
+  // Stop starting test cases on a signal, on cancellation, or past the CPU
+  // budget.
+  const double cpu_start = options.cpu_budget > 0 ? ThreadCpuSeconds() : 0;
+  bool stopped = false;
+  auto stop_requested = [&]() {
+    stopped = stopped || StopSignal() ||
+      (CurrentCancel() && CurrentCancel()->load()) ||
+      (options.cpu_budget > 0 &&
+       ThreadCpuSeconds() - cpu_start > options.cpu_budget);
+    return stopped;
+  };
+
+  // Iterate all selected unit tests
+  for (const auto& item : selected) {
+    if (stop_requested()) break;
+    const Entry& unit = *item.unit;
+    const Selection& selection = item.selection;
+    if (item.journaled) {
+      if (!unit.second.parameterized) {
+        if (item.journaled->passed) {
+          sucesses.push_back(unit.first);
+          ++passed_count;
+        } else {
+          failures.push_back(unit.first);
+        }
+      } else {
+        const size_t passed = item.journaled->passed_parameters;
+        failures.insert(failures.end(), item.journaled->failures.begin(),
+                        item.journaled->failures.end());
+        passed_count += passed;
+        if (passed) {
+          sucesses.push_back(unit.first + " (" + std::to_string(passed) +
+                             " parameters)");
+        }
+      }
+      continue;
+    }
+    WriteLine(MICROUNIT_SEPARATOR);
+    if (!unit.second.parameterized) {
+      TERMINAL_GOOD << "Test case '" << unit.first.c_str() << "'";
+      const TestOutcome outcome = run_item(unit, unit.first.c_str(), 0);
+      if (outcome == TestOutcome::kStopped) {
+        TERMINAL_BAD << "Stopped test";
+        stopped = true;
+        break;
+      }
+      if (outcome != TestOutcome::kPassed) {
+        TERMINAL_BAD << "Failed test";
+        failures.push_back(FailureName(unit.first, outcome));
+        journal.Append("fail", unit.first);
+      } else {
+        TERMINAL_GOOD << "Passed test";
+        sucesses.push_back(unit.first);
+        ++passed_count;
+        journal.Append("pass", unit.first);
+      }
+      continue;
+    }
+
+    // Parameterized test cases only report the parameters that fail.
+    const size_t count = selection.all ? unit.second.parameters :
+      selection.indices.size();
+    TERMINAL_GOOD << "Test case '" << unit.first.c_str() << "' ("
+      << count << " parameters)";
+    if (selection.all) journal.Append("start", unit.first);
+    size_t passed = 0, ran = 0;
+    std::string item_name;
+    for (size_t i = 0; i < count && !stop_requested(); ++i) {
+      const size_t index = selection.all ? i : selection.indices[i];
+      item_name.clear();
+      if (Listeners().size || Listeners().policy) {
+        item_name = unit.first + "[" + std::to_string(index) + "]";
+      }
+      const TestOutcome outcome = run_item(unit, item_name.c_str(), index);
+      if (outcome == TestOutcome::kStopped) {
+        stopped = true;
+        break;
+      }
+      ++ran;
+      if (outcome == TestOutcome::kPassed) {
+        ++passed;
+        continue;
+      }
+      item_name = unit.first + "[" + std::to_string(index) + "]";
+      TERMINAL_BAD << "Failed test '" << item_name.c_str() << "'";
+      failures.push_back(FailureName(item_name, outcome));
+      if (selection.all) journal.Append("pfail", item_name);
+    }
+    passed_count += passed;
+    // An interrupted test case has no "done" record, and is run again when
+    // the journal is resumed.
+    if (selection.all && ran == count) {
+      journal.Append("done", std::to_string(passed) + " " + unit.first);
+    }
+    if (passed == ran) {
+      TERMINAL_GOOD << "Passed test";
+    } else {
+      TERMINAL_BAD << "Failed " << ran - passed << " of " << ran
+        << " parameters";
+    }
+    if (passed) {
+      sucesses.push_back(unit.first + " (" + std::to_string(passed) +
+                         " parameters)");
+    }
+  }
+  Listeners().test_name = nullptr;
+#if !defined(_WIN32)
+  if (shared != MAP_FAILED) munmap(shared, sizeof(Observation));
+#endif
+  journal.Close();
+  for (auto teardown : Instance().teardown_functions) {
+    teardown();
+  }
+  Notify(&Listener::OnRunEnd, &PolicyHooks::on_run_end, [&]() {
+    return RunEvent{ test_count, failures.size() };
+  });
+#if defined(MICROUNIT_HAS_PMR)
+  CurrentArena() = nullptr;
+#endif
+  CurrentScratch().root = nullptr;
+  WriteLine(MICROUNIT_SEPARATOR);
+  WriteLine(MICROUNIT_SEPARATOR);
+
+  TERMINAL_GOOD << "Passed " << passed_count
+    << " test cases:";
+  for (const auto& success_t : sucesses) {
+    TERMINAL_GOOD << success_t.c_str();
+  }
+  WriteLine(MICROUNIT_SEPARATOR);
+
+  if (stopped) {
+    if (StopSignal()) {
+      TERMINAL_BAD << "Stopped by signal " << static_cast<int>(StopSignal())
+        << " after " << ran_count << " of " << test_count << " test cases";
+    } else if (CurrentCancel() && CurrentCancel()->load()) {
+      TERMINAL_BAD << "Cancelled after " << ran_count << " of "
+        << test_count << " test cases";
+    } else {
+      TERMINAL_BAD << "Used the CPU budget of " << options.cpu_budget
+        << " seconds after " << ran_count << " of " << test_count
+        << " test cases";
+    }
+    WriteLine(MICROUNIT_SEPARATOR);
+  }
+
+  // Output result summary
+  if (failures.empty()) {
+    // The tests that were not run did not pass either.
+    if (!stopped) {
+      TERMINAL_GOOD << "All tests passed";
+      WriteLine(MICROUNIT_SEPARATOR);
+    }
+    return !stopped;
+  } else {
+    TERMINAL_BAD << "Failed " << failures.size()
+      << " test cases:";
+    for (const auto& failure : failures) {
+      TERMINAL_BAD << failure.c_str();
+    }
+    WriteLine(MICROUNIT_SEPARATOR);
+    return false;
+  }
+}
+
+MICROUNIT_API int UnitTester::Main(int argc, char **argv) {
+  RunOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const char *argument = argv[i];
+    if (strncmp(argument, "--filter=", 9) == 0) {
+      options.filter = argument + 9;
+    } else if (strcmp(argument, "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (strcmp(argument, "--arena") == 0) {
+      options.arena = true;
+    } else if (strncmp(argument, "--journal=", 10) == 0) {
+      options.journal = argument + 10;
+    } else if (strcmp(argument, "--resume") == 0) {
+      options.resume = true;
+    } else if (strcmp(argument, "--isolate") == 0) {
+      options.isolate = true;
+    } else if (strncmp(argument, "--seed=", 7) == 0) {
+      options.seed = strtoull(argument + 7, nullptr, 0);
+    } else if (strncmp(argument, "--stack=", 8) == 0) {
+      options.stack_size = static_cast<size_t>(
+        strtoull(argument + 8, nullptr, 0));
+    } else if (strcmp(argument, "--leaks") == 0) {
+      options.detect_leaks = true;
+    } else if (strcmp(argument, "--leaks=fail") == 0) {
+      options.detect_leaks = true;
+      options.fail_leaks = true;
+    } else if (strncmp(argument, "--tags=", 7) == 0) {
+      options.tags = argument + 7;
+    } else if (strcmp(argument, "--io") == 0) {
+      options.report_io = true;
+    } else if (strcmp(argument, "--trace-syscalls") == 0) {
+      options.isolate = true;
+      options.trace_syscalls = true;
+    } else if (strcmp(argument, "--determinism") == 0) {
+      options.check_determinism = true;
+    } else if (strncmp(argument, "--numa-node=", 12) == 0) {
+      options.numa_node = atoi(argument + 12);
+    } else {
+      if (strcmp(argument, "--help") != 0) {
+        TERMINAL_BAD << "Unknown option '" << argument << "'";
+      }
+      WriteLine("Usage: test [options]");
+      WriteLine("  --filter=NAMES  Run only the comma separated test cases. "
+                "A trailing * matches");
+      WriteLine("                  any suffix, and NAME[index] selects one "
+                "parameter.");
+      WriteLine("  --tags=TAGS     Run only the test cases with one of the "
+                "comma separated tags.");
+      WriteLine("  --arena         Give each test case a bump allocator.");
+      WriteLine("  --journal=PATH  Record the result of each test case in "
+                "PATH as it completes.");
+      WriteLine("  --resume        Skip the test cases recorded in the "
+                "journal and report");
+      WriteLine("                  their recorded results.");
+      WriteLine("  --isolate       Run each test case in a child process, "
+                "with its resource");
+      WriteLine("                  limits.");
+      WriteLine("  --seed=N        Seed of the run, from which the seed of "
+                "each test case is");
+      WriteLine("                  derived.");
+      WriteLine("  --stack=BYTES   Run each test case on a stack of BYTES, "
+                "and log its use.");
+      WriteLine("  --leaks[=fail]  Log (or fail on) the threads and file "
+                "descriptors that");
+      WriteLine("                  each test case leaves open.");
+      WriteLine("  --io            Log the I/O counters of each test case.");
+      WriteLine("  --trace-syscalls  Isolate and log the syscalls of each "
+                "test case.");
+      WriteLine("  --determinism   Run each test case twice, and fail the "
+                "ones whose outcome,");
+      WriteLine("                  output or recorded state differs.");
+      WriteLine("  --numa-node=N   Run on the CPUs of NUMA node N, and log "
+                "where each test");
+      WriteLine("                  case ran.");
+      return strcmp(argument, "--help") == 0 ? 0 : 2;
+    }
+  }
+  options.handle_signals = true;
+  const bool success = Run(options);
+  // Like a shell, 128 plus the number of the signal that stopped the run.
+  if (StopSignal()) return 128 + static_cast<int>(StopSignal());
+  return success ? 0 : 1;
+}
+
+/**
+* @brief State of the self-test, which collects its results as a listener.
+*        It is built on first use, after the registry, so that at exit it
+*        is destroyed first, and stops the self-test while the test cases
+*        still exist.
+*/
+class SelfTestState : public Listener {
+public:
+  ~SelfTestState() {
+    cancel = true;
+    if (thread.joinable()) thread.join();
+  }
+
+  void OnRunStart(const RunEvent& event) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    status.test_count = event.test_count;
+  }
+
+  void OnTestEnd(const TestEvent& event) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (event.success) {
+      ++status.passed;
+    } else {
+      ++status.failed;
+      failures.push_back(event.name ? event.name : "");
+    }
+  }
+
+  static SelfTestState& Instance() {
+    static SelfTestState state;
+    return state;
+  }
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  SelfTestStatus status{};
+  std::vector<std::string> failures;
+  std::thread thread;
+  std::atomic<bool> cancel{ false };
+};
+
+/** @brief Run the calling thread only when the CPU would be idle. */
+inline void LowerThreadPriority() {
+#if defined(_WIN32)
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(SCHED_IDLE)
+  struct sched_param parameters;
+  memset(&parameters, 0, sizeof(parameters));
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &parameters);
+#endif
+}
+
+MICROUNIT_API bool SelfTest::Start(const SelfTestOptions& options) {
+  SelfTestState& state = SelfTestState::Instance();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (state.status.started) return false;
+  state.status.started = true;
+  state.thread = std::thread([&state, options]() {
+    LowerThreadPriority();
+    static const OutputCallback discard = [](const char*, size_t, void*) {};
+    CurrentRedirect() = OutputRedirect{
+      options.output ? options.output : discard, options.context };
+    CurrentCancel() = &state.cancel;
+    RunOptions run_options;
+    run_options.tags = options.tags;
+    run_options.cpu_budget = options.cpu_budget;
+    const bool added = UnitTester::AddListener(&state);
+    UnitTester::Run(run_options);
+    if (added) UnitTester::RemoveListener(&state);
+    std::lock_guard<std::mutex> finished_lock(state.mutex);
+    state.status.finished = true;
+    state.status.complete = !state.cancel &&
+      state.status.passed + state.status.failed == state.status.test_count;
+    state.finished.notify_all();
+  });
+  return true;
+}
+
+MICROUNIT_API SelfTestStatus SelfTest::Status() {
+  SelfTestState& state = SelfTestState::Instance();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  return state.status;
+}
+
+MICROUNIT_API void SelfTest::ForEachFailure(
+    void(*visit)(const char *name, void *context), void *context) {
+  SelfTestState& state = SelfTestState::Instance();
+  std::vector<std::string> failures;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    failures = state.failures;
+  }
+  for (const auto& failure : failures) {
+    visit(failure.c_str(), context);
+  }
+}
+
+MICROUNIT_API void SelfTest::Wait() {
+  SelfTestState& state = SelfTestState::Instance();
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.finished.wait(lock, [&]() {
+    return !state.status.started || state.status.finished;
+  });
+}
+
+MICROUNIT_API void SelfTest::Cancel() {
+  SelfTestState::Instance().cancel = true;
+  Wait();
+}
+}
+#endif
+
+#if defined(MICROUNIT_RUNNER) && defined(MICROUNIT_FREESTANDING)
+namespace microunit {
+/**
+* @brief Registered test cases, sorted by name, and teardown functions, in
+*        fixed-size storage. It is zero-initialized, so that Instance()
+*        needs no guard variable.
+*/
+struct UnitTester::Registry {
+  struct Unit {
+    const char *name;
+    const char *type_name;
+    size_t name_size;
+    size_t type_name_size;
+    UnitFunction function;
+    bool success;
+  };
+  Unit units[MICROUNIT_MAX_UNITS];
+  size_t size;
+  void(*teardown_functions[MICROUNIT_MAX_TEARDOWNS])();
+  size_t teardown_size;
+  /** @brief Registrations that did not fit. */
+  size_t dropped;
+  /** @brief Registrations with the name of a test case already registered. */
+  size_t duplicates;
+
+  /** @brief Character of the full name of a unit, "name<type_name>" for
+  *          typed test cases, or '\0' past its end. */
+  static char NameAt(const Unit& unit, size_t i) {
+    if (i < unit.name_size) return unit.name[i];
+    if (!unit.type_name) return '\0';
+    i -= unit.name_size;
+    if (i == 0) return '<';
+    if (i <= unit.type_name_size) return unit.type_name[i - 1];
+    return i == unit.type_name_size + 1 ? '>' : '\0';
+  }
+
+  /** @brief Order of two units by full name, as in the default mode. */
+  static int Compare(const Unit& a, const Unit& b) {
+    for (size_t i = 0;; ++i) {
+      const unsigned char ca = NameAt(a, i), cb = NameAt(b, i);
+      if (ca != cb) return ca < cb ? -1 : 1;
+      if (ca == '\0') return 0;
+    }
+  }
+
+  /** @brief Full name of a unit, truncated to the size of the buffer. */
+  template <size_t Size>
+  static const char* FullName(const Unit& unit, char (&buffer)[Size]) {
+    if (!unit.type_name) return unit.name;
+    size_t i = 0;
+    for (; i + 1 < Size && NameAt(unit, i) != '\0'; ++i) {
+      buffer[i] = NameAt(unit, i);
+    }
+    buffer[i] = '\0';
+    return buffer;
+  }
+
+  /** @brief Log the full name of a unit. */
+  static void Log(LogLine& line, const Unit& unit) {
+    line << unit.name;
+    if (unit.type_name) line << '<' << unit.type_name << '>';
+  }
+};
+
+MICROUNIT_API UnitTester::Registry& UnitTester::Instance() {
+  static Registry registry;
+  return registry;
+}
+
+MICROUNIT_API void UnitTester::RegisterFunction(const char *name,
+                                                UnitFunction function,
+                                                const char *type_name) {
+  Registry& registry = Instance();
+  const Registry::Unit unit = { name, type_name, strlen(name),
+    type_name ? strlen(type_name) : 0, function, true };
+  size_t position = registry.size;
+  for (; position > 0; --position) {
+    const int order = Registry::Compare(registry.units[position - 1], unit);
+    if (order == 0) {
+      ++registry.duplicates;
+      return;
+    }
+    if (order < 0) break;
+  }
+  if (registry.size == MICROUNIT_MAX_UNITS) {
+    ++registry.dropped;
+    return;
+  }
+  for (size_t i = registry.size; i > position; --i) {
+    registry.units[i] = registry.units[i - 1];
+  }
+  registry.units[position] = unit;
+  ++registry.size;
+}
+
+MICROUNIT_API void UnitTester::RegisterTeardown(void(*function)()) {
+  Registry& registry = Instance();
+  if (registry.teardown_size == MICROUNIT_MAX_TEARDOWNS) {
+    ++registry.dropped;
+    return;
+  }
+  registry.teardown_functions[registry.teardown_size++] = function;
+}
+
+MICROUNIT_API bool UnitTester::Run(const RunOptions& options) {
+  (void)options;
+  Registry& registry = Instance();
+  size_t failures = 0;
+
+  TERMINAL_INFO
+    << "Will run " << registry.size << " test cases";
+  if (registry.dropped) {
+    TERMINAL_BAD << registry.dropped << " registrations did not fit in "
+      "MICROUNIT_MAX_UNITS or MICROUNIT_MAX_TEARDOWNS";
+  }
+  if (registry.duplicates) {
+    TERMINAL_BAD << registry.duplicates << " registrations reused the name "
+      "of another test case and were ignored";
+  }
+  Notify(&Listener::OnRunStart, &PolicyHooks::on_run_start, [&]() {
+    return RunEvent{ registry.size, 0 };
+  });
+
+  for (size_t i = 0; i < registry.size; ++i) {
+    Registry::Unit& unit = registry.units[i];
+    WriteLine(MICROUNIT_SEPARATOR);
+    {
+      LogLine line(COLORCODE_GREEN);
+      line << "Test case '";
+      Registry::Log(line, unit);
+      line << "'";
+    }
+    char name[128];
+    const char *test_name = Listeners().size || Listeners().policy ?
+      Registry::FullName(unit, name) : unit.name;
+    Listeners().test_name = test_name;
+    Notify(&Listener::OnTestStart, &PolicyHooks::on_test_start, [&]() {
+      return TestEvent{ test_name, true };
+    });
+
+    UnitFunctionResult result;
+    unit.function(&result);
+    unit.success = result.success;
+    Notify(&Listener::OnTestEnd, &PolicyHooks::on_test_end, [&]() {
+      return TestEvent{ test_name, result.success };
+    });
+    if (!result.success) {
+      TERMINAL_BAD << "Failed test";
+      ++failures;
+    } else {
+      TERMINAL_GOOD << "Passed test";
+    }
+  }
+  Listeners().test_name = nullptr;
+  for (size_t i = 0; i < registry.teardown_size; ++i) {
+    registry.teardown_functions[i]();
+  }
+  Notify(&Listener::OnRunEnd, &PolicyHooks::on_run_end, [&]() {
+    return RunEvent{ registry.size, failures };
+  });
+  WriteLine(MICROUNIT_SEPARATOR);
+  WriteLine(MICROUNIT_SEPARATOR);
+
+  TERMINAL_GOOD << "Passed " << registry.size - failures
+    << " test cases:";
+  for (size_t i = 0; i < registry.size; ++i) {
+    if (!registry.units[i].success) continue;
+    LogLine line(COLORCODE_GREEN);
+    Registry::Log(line, registry.units[i]);
+  }
+  WriteLine(MICROUNIT_SEPARATOR);
+
+  if (failures == 0) {
+    TERMINAL_GOOD << "All tests passed";
+    WriteLine(MICROUNIT_SEPARATOR);
+    return registry.dropped == 0 && registry.duplicates == 0;
+  }
+  TERMINAL_BAD << "Failed " << failures << " test cases:";
+  for (size_t i = 0; i < registry.size; ++i) {
+    if (registry.units[i].success) continue;
+    LogLine line(COLORCODE_RED);
+    Registry::Log(line, registry.units[i]);
+  }
+  WriteLine(MICROUNIT_SEPARATOR);
+  return false;
+}
+
+/** @brief Output sink set with SetOutputSink. */
+inline OutputSink& CurrentOutputSink() {
+  static OutputSink sink = nullptr;
+  return sink;
+}
+
+MICROUNIT_API void SetOutputSink(OutputSink sink) {
+  CurrentOutputSink() = sink;
+}
+}
+#endif
+
+#if defined(MICROUNIT_RUNNER)
+namespace microunit {
+MICROUNIT_API ListenerList& Listeners() {
+  static ListenerList list;
+  return list;
+}
+
+MICROUNIT_API bool UnitTester::AddListener(Listener *listener) {
+  ListenerList& list = Listeners();
+  if (list.size == MICROUNIT_MAX_LISTENERS) return false;
+  list.listeners[list.size++] = listener;
+  return true;
+}
+
+MICROUNIT_API void UnitTester::RemoveListener(Listener *listener) {
+  ListenerList& list = Listeners();
+  for (size_t i = 0; i < list.size; ++i) {
+    if (list.listeners[i] != listener) continue;
+    for (--list.size; i < list.size; ++i) {
+      list.listeners[i] = list.listeners[i + 1];
+    }
+    return;
+  }
+}
+
+MICROUNIT_COLD MICROUNIT_API void ReportFailure(const SourceLocation& location,
+                                                UnitFunctionResult *result) {
+  Notify(&Listener::OnAssertionFailure, &PolicyHooks::on_assertion_failure,
+         [&]() {
+    return FailureEvent{ Listeners().test_name, &location };
+  });
+  if (location.message) {
+    TERMINAL_BAD << location.file << ":" << location.line << ": "
+      << location.message;
+  }
+  TERMINAL_BAD << location.file << ":" << location.line
+    << ": Test stopped: Fail";
+  result->success = false;
+}
+
+MICROUNIT_NOINLINE MICROUNIT_API void ReportPass(
+  const SourceLocation& location, UnitFunctionResult *result) {
+  TERMINAL_GOOD << location.file << ":" << location.line
+    << ": Test stopped: Pass";
+  result->success = true;
+}
+
+MICROUNIT_API void WriteOutput(const char *data, size_t size) {
+#if defined(MICROUNIT_FREESTANDING)
+  const OutputSink sink = CurrentOutputSink();
+  if (!sink) return;
+  for (size_t i = 0; i < size; ++i) {
+    sink(data[i]);
+  }
+#else
+  Observation *observation = CurrentObservation();
+  if (observation) {
+    observation->output = HashBytes(observation->output, data, size);
+  }
+  const OutputRedirect& redirect = CurrentRedirect();
+  if (redirect.callback) {
+    redirect.callback(data, size, redirect.context);
+    return;
+  }
+#if !defined(MICROUNIT_STREAMS)
+  while (size > 0) {
+#if defined(_WIN32)
+    const int written = _write(1, data, static_cast<unsigned int>(size));
+#else
+    const ssize_t written = write(1, data, size);
+#endif
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+#else
+  std::cout.write(data, static_cast<std::streamsize>(size));
+  std::cout.flush();
+#endif
+#endif
+}
+
+MICROUNIT_API LogLine::LogLine(int color_code) : color_code_(color_code) {
+#if !defined(MICROUNIT_FREESTANDING)
+  // Redirected output has no colors, nor has output that is compared
+  // between runs (see RunOptions::check_determinism).
+  if (CurrentRedirect().callback || CurrentObservation()) color_code_ = -1;
+#endif
+  if (color_code_ >= 0) {
+#if defined(_WIN32) && !defined(MICROUNIT_FREESTANDING)
+    SetTerminalColor(color_code_);
+#else
+    *this << AnsiColorCode(color_code_);
+#endif
+  }
+  *this << "[    ] ";
+}
+
+MICROUNIT_API LogLine::~LogLine() {
+#if defined(MICROUNIT_STREAMS)
+  Drain();
+#endif
+  *this << '\n';
+#if defined(_WIN32) && !defined(MICROUNIT_FREESTANDING)
+  Flush();
+  if (color_code_ >= 0) SetTerminalColor(COLORCODE_GREY);
+#else
+  if (color_code_ >= 0) *this << AnsiColorCode(COLORCODE_GREY);
+  Flush();
+#endif
+}
+
+MICROUNIT_API void LogLine::Append(const char *data, size_t size) {
+  while (size_ + size > sizeof(buffer_)) {
+    const size_t chunk = sizeof(buffer_) - size_;
+    memcpy(buffer_ + size_, data, chunk);
+    size_ += chunk;
+    data += chunk;
+    size -= chunk;
+    Flush();
+  }
+  memcpy(buffer_ + size_, data, size);
+  size_ += size;
+}
+
+MICROUNIT_API void LogLine::Flush() {
+  WriteOutput(buffer_, size_);
+  size_ = 0;
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(const char *value) {
+  if (!value) value = "(null)";
+  if (Streamed(value)) return *this;
+  Append(value, strlen(value));
+  return *this;
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(char value) {
+  if (Streamed(value)) return *this;
+  Append(&value, 1);
+  return *this;
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(bool value) {
+  if (Streamed(value)) return *this;
+  return *this << (value ? "1" : "0");
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(unsigned long long value) {
+  if (Streamed(value)) return *this;
+  char digits[24];
+  char *begin = digits + sizeof(digits);
+  do {
+    *--begin = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  Append(begin, static_cast<size_t>(digits + sizeof(digits) - begin));
+  return *this;
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(long long value) {
+  if (Streamed(value)) return *this;
+  if (value < 0) {
+    *this << '-';
+    return *this << (0ull - static_cast<unsigned long long>(value));
+  }
+  return *this << static_cast<unsigned long long>(value);
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(double value) {
+  if (Streamed(value)) return *this;
+#if defined(MICROUNIT_FREESTANDING)
+  // Without snprintf: up to six decimals, in scientific notation from 1e15.
+  if (value != value) return *this << "nan";
+  if (value < 0) {
+    *this << '-';
+    value = -value;
+  }
+  if (value > 1.7976931348623157e308) return *this << "inf";
+  int exponent = 0;
+  if (value >= 1e15) {
+    for (; value >= 10; ++exponent) value /= 10;
+  }
+  unsigned long long integral = static_cast<unsigned long long>(value);
+  unsigned long long fraction = static_cast<unsigned long long>(
+    (value - static_cast<double>(integral)) * 1e6 + 0.5);
+  if (fraction >= 1000000) {
+    ++integral;
+    fraction -= 1000000;
+  }
+  *this << integral;
+  if (fraction) {
+    char digits[7] = { '.' };
+    size_t size = 7;
+    for (size_t i = 6; i > 0; --i, fraction /= 10) {
+      digits[i] = static_cast<char>('0' + fraction % 10);
+    }
+    while (digits[size - 1] == '0') --size;
+    Append(digits, size);
+  }
+  if (exponent) *this << "e+" << exponent;
+#else
+  char text[32];
+  const int size = snprintf(text, sizeof(text), "%g", value);
+  Append(text, size > 0 ? static_cast<size_t>(size) : 0);
+#endif
+  return *this;
+}
+
+MICROUNIT_API LogLine& LogLine::operator<<(const void *value) {
+  if (Streamed(value)) return *this;
+#if defined(MICROUNIT_FREESTANDING)
+  uintptr_t bits = reinterpret_cast<uintptr_t>(value);
+  char digits[2 + 2 * sizeof(bits)];
+  char *begin = digits + sizeof(digits);
+  do {
+    *--begin = "0123456789abcdef"[bits & 0xF];
+    bits >>= 4;
+  } while (bits);
+  *--begin = 'x';
+  *--begin = '0';
+  Append(begin, static_cast<size_t>(digits + sizeof(digits) - begin));
+#else
+  char text[24];
+  const int size = snprintf(text, sizeof(text), "%p", value);
+  Append(text, size > 0 ? static_cast<size_t>(size) : 0);
+#endif
+  return *this;
+}
+
+#if !defined(MICROUNIT_LEAN) && !defined(MICROUNIT_FREESTANDING)
+MICROUNIT_API LogLine& LogLine::operator<<(const Color& color) {
+#if defined(_WIN32)
+#if defined(MICROUNIT_STREAMS)
+  Drain();
+#endif
+  Flush();
+  color.Set();
+#else
+  *this << AnsiColorCode(color.code());
+#endif
+  return *this;
+}
+#endif
+}
+#endif
+#endif
 #endif
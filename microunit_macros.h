@@ -0,0 +1,18 @@
+/**
+* @file microunit_macros.h
+* @brief Macro layer of microunit (UNIT, ASSERT_TRUE, LOG_INFO, ...) for
+*        translation units that import the microunit C++20 module instead of
+*        including microunit.h. See microunit.cppm.
+*
+* @copyright Copyright (c) 2016-2017, Sebastiao Salvador de Miranda.
+*            All rights reserved. See licence in microunit.h.
+*/
+#ifndef _MICROUNIT_MACROS_H_
+#define _MICROUNIT_MACROS_H_
+// The registration templates that the importers instantiate use placement
+// new, which the module does not export.
+#include <new>
+#define MICROUNIT_MACROS_ONLY
+#include "microunit.h"
+#undef MICROUNIT_MACROS_ONLY
+#endif
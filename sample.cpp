@@ -1,3 +1,5 @@
+// The one file of this program also compiles the runner.
+#define MICROUNIT_IMPLEMENTATION
 #include "microunit.h"
 
 int Double(int n) {
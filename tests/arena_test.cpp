@@ -0,0 +1,96 @@
+// Tests of ArenaResource: the count of unreleased bytes, the reuse of its
+// blocks after a reset, the poisoning of released memory, and the arena of
+// each test case under --arena. C++17.
+//
+//   g++ -std=c++17 -I. tests/arena_test.cpp -o arena_test -pthread
+//   ./arena_test
+//
+// Not for AddressSanitizer builds, which fault on the reads of released
+// memory that check the poison.
+#include <string.h>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+UNIT(Test_Arena_Outstanding) {
+  microunit::ArenaResource arena;
+  void *a = arena.allocate(100, 8);
+  void *b = arena.allocate(28, 4);
+  ASSERT_TRUE(arena.outstanding() == 128);
+  arena.deallocate(a, 100, 8);
+  ASSERT_TRUE(arena.outstanding() == 28);
+  // Reset returns the bytes never deallocated, and clears the count.
+  ASSERT_TRUE(arena.Reset() == 28);
+  ASSERT_TRUE(arena.outstanding() == 0);
+  arena.deallocate(arena.allocate(64, 8), 64, 8);
+  ASSERT_TRUE(arena.Reset() == 0);
+  (void)b;
+};
+
+UNIT(Test_Arena_Reuse) {
+  microunit::ArenaOptions options;
+  options.chunk_size = 4096;
+  microunit::ArenaResource arena(options);
+  char *first = static_cast<char*>(arena.allocate(3000, 8));
+  // Does not fit in the rest of the first block.
+  char *second = static_cast<char*>(arena.allocate(3000, 8));
+  // Larger than a block.
+  char *large = static_cast<char*>(arena.allocate(10000, 64));
+  ASSERT_TRUE(reinterpret_cast<uintptr_t>(large) % 64 == 0);
+  arena.Reset();
+  // The same blocks are handed out again, in the same order.
+  ASSERT_TRUE(arena.allocate(3000, 8) == first);
+  ASSERT_TRUE(arena.allocate(3000, 8) == second);
+  ASSERT_TRUE(arena.allocate(10000, 64) == large);
+};
+
+UNIT(Test_Arena_Poison) {
+  microunit::ArenaOptions options;
+  options.poison = true;
+  microunit::ArenaResource arena(options);
+  char *bytes = static_cast<char*>(arena.allocate(256, 1));
+  memset(bytes, 0x11, 256);
+  arena.Reset();
+  for (int i = 0; i < 256; ++i) {
+    ASSERT_TRUE(static_cast<unsigned char>(bytes[i]) == 0xDD);
+  }
+  // Memory handed out again is not poisoned by the arena.
+  ASSERT_TRUE(arena.allocate(256, 1) == bytes);
+
+  // Without the option, released memory is left as it was.
+  microunit::ArenaResource plain;
+  bytes = static_cast<char*>(plain.allocate(256, 1));
+  memset(bytes, 0x11, 256);
+  plain.Reset();
+  ASSERT_TRUE(bytes[0] == 0x11 && bytes[255] == 0x11);
+};
+
+// The test cases under --arena run in name order, and each gets the arena
+// back empty.
+static void *first_test_allocation = nullptr;
+
+UNIT(Test_Arena_Run_A) {
+  ASSERT_TRUE(microunit::CurrentArena() != nullptr);
+  ASSERT_TRUE(microunit::TestArena() == microunit::CurrentArena());
+  std::pmr::vector<int> values({ 1, 2, 3 }, microunit::TestArena());
+  first_test_allocation = values.data();
+  // Leaked on purpose: the reset reclaims it.
+  void *leaked = microunit::TestArena()->allocate(1000, 8);
+  ASSERT_TRUE(leaked != nullptr);
+};
+
+UNIT(Test_Arena_Run_B) {
+  ASSERT_TRUE(microunit::CurrentArena()->outstanding() == 0);
+  std::pmr::vector<int> values({ 1, 2, 3 }, microunit::TestArena());
+  // Unless Test_Arena_Run_A was filtered out.
+  ASSERT_TRUE(!first_test_allocation ||
+              values.data() == first_test_allocation);
+};
+
+int main(int argc, char **argv) {
+  static char arena[] = "--arena";
+  std::vector<char*> arguments(argv, argv + argc);
+  arguments.insert(arguments.begin() + 1, arena);
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
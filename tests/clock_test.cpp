@@ -0,0 +1,79 @@
+// Tests of VirtualClock: the jumps of time while every participant thread
+// sleeps, and the order of timers.
+//
+//   g++ -std=c++11 -I. tests/clock_test.cpp -o clock_test -pthread
+//   ./clock_test
+#include <chrono>
+#include <thread>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+using std::chrono::seconds;
+
+UNIT(Test_Clock_Participants) {
+  microunit::VirtualClock clock(2);
+  const auto start = clock.Now();
+  microunit::Clock::time_point other_woke;
+  std::thread other([&]() {
+    clock.SleepFor(seconds(10));
+    // The test thread sleeps until 15, so time stays at 10.
+    other_woke = clock.Now();
+    clock.RemoveParticipant();
+  });
+  // Time does not move until the other thread sleeps too.
+  clock.SleepFor(seconds(5));
+  const auto first_woke = clock.Now();
+  clock.SleepFor(seconds(10));
+  const auto second_woke = clock.Now();
+  other.join();
+  ASSERT_TRUE(first_woke - start == seconds(5));
+  ASSERT_TRUE(other_woke - start == seconds(10));
+  ASSERT_TRUE(second_woke - start == seconds(15));
+};
+
+UNIT(Test_Clock_Added_Participants) {
+  microunit::VirtualClock clock;
+  const auto start = clock.Now();
+  std::vector<std::thread> sleepers;
+  std::vector<microunit::Clock::time_point> woke(4);
+  for (int i = 0; i < 4; ++i) {
+    clock.AddParticipant();
+    sleepers.emplace_back([&, i]() {
+      clock.SleepFor(seconds(4 - i));
+      woke[i] = clock.Now();
+      clock.RemoveParticipant();
+    });
+  }
+  clock.SleepFor(seconds(10));
+  for (auto& sleeper : sleepers) sleeper.join();
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(woke[i] - start == seconds(4 - i));
+  }
+  ASSERT_TRUE(clock.Now() - start == seconds(10));
+};
+
+UNIT(Test_Clock_Timers) {
+  microunit::VirtualClock clock;
+  const auto start = clock.Now();
+  std::vector<int> fired;
+  clock.AddTimer(start + seconds(2), [&]() { fired.push_back(2); });
+  clock.AddTimer(start + seconds(1), [&]() { fired.push_back(1); });
+  // Ties fire in the order they were added.
+  clock.AddTimer(start + seconds(2), [&]() { fired.push_back(3); });
+  // A timer may re-arm itself from its callback.
+  clock.AddTimer(start + seconds(3), [&]() {
+    fired.push_back(4);
+    clock.AddTimer(clock.Now() + seconds(1), [&]() { fired.push_back(5); });
+  });
+  clock.Advance(seconds(3));
+  ASSERT_TRUE((fired == std::vector<int>{ 1, 2, 3, 4 }));
+  // The sleeper waits for the re-armed timer, which fires first.
+  clock.SleepFor(seconds(2));
+  ASSERT_TRUE((fired == std::vector<int>{ 1, 2, 3, 4, 5 }));
+  ASSERT_TRUE(clock.Now() - start == seconds(5));
+};
+
+int main(int argc, char **argv) {
+  return microunit::UnitTester::Main(argc, argv);
+}
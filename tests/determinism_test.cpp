@@ -0,0 +1,105 @@
+// Tests of --determinism: a test case whose outcome, output or recorded state
+// changes between its two runs fails as nondeterministic. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/determinism_test.cpp -o determinism_test -pthread
+//   ./determinism_test
+//
+// The tests run this program again with "varying" as first argument, which
+// registers the Varying_* test cases instead.
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+// Run the Varying_* test cases in a child process with OPTIONS, and return
+// its output.
+static std::string RunVarying(const char *options) {
+  const std::string command = "'" + self_path + "' varying " + options +
+    " 2>&1";
+  std::string output;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  pclose(pipe);
+  return output;
+}
+
+static bool Contains(const std::string& text, const char *part) {
+  return text.find(part) != std::string::npos;
+}
+
+// The output of the test case NAME, up to the next one.
+static std::string Section(const std::string& output, const char *name) {
+  const size_t start = output.find(std::string("Test case '") + name + "'");
+  if (start == std::string::npos) return std::string();
+  const size_t end = output.find("Test case '", start + 1);
+  return output.substr(start, end == std::string::npos ? end : end - start);
+}
+
+UNIT(Test_Determinism_Mismatch) {
+  const std::string output = RunVarying("--determinism");
+  ASSERT_TRUE(Contains(Section(output, "Varying_Outcome"),
+                       "Nondeterministic outcome: passed, then failed"));
+  ASSERT_TRUE(Contains(Section(output, "Varying_Output"),
+                       "Nondeterministic output"));
+  ASSERT_TRUE(Contains(Section(output, "Varying_State"),
+                       "Nondeterministic state"));
+  ASSERT_FALSE(Contains(Section(output, "Varying_Stable"), "Nondeterministic"));
+  ASSERT_TRUE(Contains(output, "Failed 3 test cases"));
+  ASSERT_TRUE(Contains(output, "Passed 1 test cases"));
+};
+
+UNIT(Test_Determinism_Isolated) {
+  // Each run is a child of its own, so only the seeded state is compared.
+  const std::string output = RunVarying("--determinism --isolate");
+  ASSERT_TRUE(Contains(output, "Passed 4 test cases"));
+};
+
+UNIT(Test_Determinism_Off) {
+  // A single run cannot differ.
+  const std::string output = RunVarying("");
+  ASSERT_FALSE(Contains(output, "Nondeterministic"));
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+};
+
+static void RegisterVarying() {
+  using microunit::UnitTester;
+  UnitTester::RegisterCallable("Varying_Outcome", UNIT_LAMBDA() {
+    static int runs = 0;
+    ASSERT_TRUE(++runs == 1);
+  });
+  UnitTester::RegisterCallable("Varying_Output", UNIT_LAMBDA() {
+    static int runs = 0;
+    LOG_INFO << "run " << ++runs;
+  });
+  UnitTester::RegisterCallable("Varying_State", UNIT_LAMBDA() {
+    static int runs = 0;
+    ++runs;
+    microunit::RecordState(&runs, sizeof(runs));
+  });
+  UnitTester::RegisterCallable("Varying_Stable", UNIT_LAMBDA() {
+    // The seed is the same in both runs.
+    const uint64_t seed = microunit::TestSeed();
+    LOG_INFO << "seed " << static_cast<unsigned long long>(seed);
+    microunit::RecordState(&seed, sizeof(seed));
+  });
+}
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  std::vector<char*> arguments(argv, argv + argc);
+  if (argc > 1 && strcmp(argv[1], "varying") == 0) {
+    RegisterVarying();
+    static char filter[] = "--filter=Varying_*";
+    arguments[1] = filter;
+  } else {
+    static char filter[] = "--filter=Test_*";
+    arguments.insert(arguments.begin() + 1, filter);
+  }
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
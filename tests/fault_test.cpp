@@ -0,0 +1,133 @@
+// Tests of FaultyFileIo: its schedules of faults, and their determinism for a
+// given seed, including TestSeed() across runs. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/fault_test.cpp -o fault_test -pthread
+//   ./fault_test
+//
+// The tests run this program again with "seeded" as first argument, which
+// runs a test case that prints its seed and the faults it got.
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+// Accepts every byte, and reads zeros.
+class NullFileIo : public microunit::FileIo {
+public:
+  ptrdiff_t Read(int, void *buffer, size_t size) override {
+    memset(buffer, 0, size);
+    return static_cast<ptrdiff_t>(size);
+  }
+  ptrdiff_t Write(int, const void*, size_t size) override {
+    return static_cast<ptrdiff_t>(size);
+  }
+};
+
+// The outcome of 200 writes of 100 bytes through faults with probabilities:
+// 'F' for a failure, 'S' for a short write, '.' for a full one.
+static std::string Faults(uint64_t seed) {
+  NullFileIo target;
+  microunit::FaultyFileIo io(seed, target);
+  io.OnWrite(microunit::Fault::WithProbability(0.2).Fail(EIO));
+  io.OnWrite(microunit::Fault::WithProbability(0.3).Short(0.5));
+  std::string faults;
+  char buffer[100] = {};
+  for (int i = 0; i < 200; ++i) {
+    const ptrdiff_t written = io.Write(1, buffer, sizeof(buffer));
+    faults += written < 0 ? 'F' : written < 100 ? 'S' : '.';
+  }
+  return faults;
+}
+
+UNIT(Test_Fault_Every) {
+  NullFileIo target;
+  microunit::FaultyFileIo io(0, target);
+  io.OnRead(microunit::Fault::Every(3).Short(0.25));
+  io.OnRead(microunit::Fault::Every(4).Fail(EINTR));
+  char buffer[100];
+  std::vector<ptrdiff_t> reads;
+  for (int i = 0; i < 12; ++i) {
+    errno = 0;
+    const ptrdiff_t size = io.Read(0, buffer, sizeof(buffer));
+    ASSERT_TRUE(size >= 0 || errno == EINTR);
+    reads.push_back(size);
+  }
+  // The 12th call is short, then fails: the failure wins.
+  ASSERT_TRUE((reads == std::vector<ptrdiff_t>{
+    100, 100, 25, -1, 100, 25, 100, -1, 25, 100, 100, -1 }));
+  ASSERT_TRUE(io.Injected() == 7);
+  // The schedules of reads and writes are separate.
+  ASSERT_TRUE(io.Write(1, buffer, sizeof(buffer)) == 100);
+};
+
+UNIT(Test_Fault_Sleep) {
+  NullFileIo target;
+  microunit::VirtualClock clock;
+  microunit::FaultyFileIo io(0, target, clock);
+  io.OnWrite(microunit::Fault::Every(2).Sleep(std::chrono::seconds(3)));
+  const auto start = clock.Now();
+  char buffer[10] = {};
+  for (int i = 0; i < 5; ++i) io.Write(1, buffer, sizeof(buffer));
+  ASSERT_TRUE(clock.Now() - start == std::chrono::seconds(6));
+};
+
+UNIT(Test_Fault_Seed) {
+  const std::string faults = Faults(42);
+  ASSERT_TRUE(faults == Faults(42));
+  ASSERT_TRUE(faults != Faults(43));
+  // Roughly the programmed rates.
+  const auto failures = std::count(faults.begin(), faults.end(), 'F');
+  const auto shorts = std::count(faults.begin(), faults.end(), 'S');
+  ASSERT_TRUE(failures > 20 && failures < 60);
+  ASSERT_TRUE(shorts > 30 && shorts < 80);
+};
+
+UNIT(Seeded_Faults) {
+  printf("seed %llu faults %s\n",
+         static_cast<unsigned long long>(microunit::TestSeed()),
+         Faults(microunit::TestSeed()).c_str());
+  fflush(stdout);
+};
+
+// The line that Seeded_Faults prints in a run with OPTIONS, or "".
+static std::string SeededLine(const char *options) {
+  const std::string command = "'" + self_path + "' seeded " + options;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return std::string();
+  std::string output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  pclose(pipe);
+  const size_t start = output.find("seed ");
+  if (start == std::string::npos) return std::string();
+  return output.substr(start, output.find('\n', start) - start);
+}
+
+UNIT(Test_Fault_Test_Seed) {
+  // The same run seed gives the same faults, in a new process too.
+  const std::string first = SeededLine("--seed=7");
+  ASSERT_FALSE(first.empty());
+  ASSERT_TRUE(first == SeededLine("--seed=7"));
+  ASSERT_TRUE(first == SeededLine("--seed=7 --isolate"));
+  ASSERT_TRUE(first != SeededLine("--seed=8"));
+};
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  static char tests[] = "--filter=Test_*";
+  static char seeded[] = "--filter=Seeded_*";
+  std::vector<char*> arguments(argv, argv + argc);
+  if (argc > 1 && strcmp(argv[1], "seeded") == 0) {
+    arguments[1] = seeded;
+  } else {
+    arguments.insert(arguments.begin() + 1, tests);
+  }
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
@@ -0,0 +1,121 @@
+// Tests of the lifetime of fixtures: a UNIT_SHARED fixture is built once and
+// destroyed after its last user, or at the end of the run when some users
+// did not run, and the pooled UNIT_F fixtures are reset and destroyed at the
+// end of the run. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/fixture_test.cpp -o fixture_test -pthread
+//   ./fixture_test
+//
+// The tests run this program again with "counted" as first argument, which
+// runs the Counted_* test cases and then prints the counters.
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+struct Counters {
+  int built;
+  int destroyed;
+  int reset;
+};
+static Counters shared_counters;
+static Counters pooled_counters;
+
+struct SharedIndex {
+  SharedIndex() { ++shared_counters.built; }
+  ~SharedIndex() { ++shared_counters.destroyed; }
+};
+
+struct PooledBuffer {
+  PooledBuffer() { ++pooled_counters.built; }
+  ~PooledBuffer() { ++pooled_counters.destroyed; }
+  void Reset() { ++pooled_counters.reset; }
+};
+
+UNIT_SHARED(SharedIndex, Counted_Shared_A) {
+  ASSERT_TRUE(shared_counters.built == 1 && shared_counters.destroyed == 0);
+};
+
+UNIT_SHARED(SharedIndex, Counted_Shared_B) {
+  ASSERT_TRUE(shared_counters.built == 1 && shared_counters.destroyed == 0);
+};
+
+// Sorted after the users of SharedIndex.
+UNIT(Counted_Shared_Released) {
+  ASSERT_TRUE(shared_counters.destroyed == shared_counters.built);
+};
+
+UNIT_F(PooledBuffer, Counted_Pooled_A) {
+  ASSERT_TRUE(pooled_counters.built == 1 && pooled_counters.destroyed == 0);
+};
+
+UNIT_F(PooledBuffer, Counted_Pooled_B) {
+  ASSERT_TRUE(pooled_counters.built == 1 && pooled_counters.destroyed == 0);
+};
+
+// Run the Counted_* test cases in a child process with OPTIONS, and return
+// its output.
+static std::string RunCounted(const char *options) {
+  const std::string command = "'" + self_path + "' counted " + options +
+    " 2>&1";
+  std::string output;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  pclose(pipe);
+  return output;
+}
+
+static bool Contains(const std::string& text, const char *part) {
+  return text.find(part) != std::string::npos;
+}
+
+UNIT(Test_Fixture_Lifetime) {
+  const std::string output = RunCounted("");
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+  ASSERT_TRUE(Contains(output, "shared 1 1\n"));
+  // Pooled fixtures are reset on reuse and destroyed by the teardown.
+  ASSERT_TRUE(Contains(output, "pooled 1 1 1\n"));
+};
+
+UNIT(Test_Fixture_Partial_Run) {
+  // The fixture outlives its only user that runs, until the end of the run.
+  const std::string output = RunCounted("--filter=Counted_Shared_A");
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+  ASSERT_TRUE(Contains(output, "shared 1 1\n"));
+  ASSERT_TRUE(Contains(output, "pooled 0 0 0\n"));
+};
+
+UNIT(Test_Fixture_Determinism) {
+  // Both runs of each test case share one fixture.
+  const std::string output = RunCounted("--determinism");
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+  ASSERT_TRUE(Contains(output, "shared 1 1\n"));
+};
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  if (argc > 1 && strcmp(argv[1], "counted") == 0) {
+    // A --filter among the arguments comes later, and wins.
+    static char filter[] = "--filter=Counted_*";
+    std::vector<char*> arguments(argv + 1, argv + argc);
+    arguments[0] = filter;
+    arguments.insert(arguments.begin(), argv[0]);
+    const int code = microunit::UnitTester::Main(
+      static_cast<int>(arguments.size()), arguments.data());
+    printf("shared %d %d\n", shared_counters.built,
+           shared_counters.destroyed);
+    printf("pooled %d %d %d\n", pooled_counters.built,
+           pooled_counters.destroyed, pooled_counters.reset);
+    return code;
+  }
+  static char filter[] = "--filter=Test_*";
+  std::vector<char*> arguments(argv, argv + argc);
+  arguments.insert(arguments.begin() + 1, filter);
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
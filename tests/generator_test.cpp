@@ -0,0 +1,50 @@
+// Tests of the index math of the generators of parameterized test cases, and
+// of the selection of their parameters by --filter.
+//
+//   g++ -std=c++11 -I. tests/generator_test.cpp -o generator_test -pthread
+//   ./generator_test
+#include <tuple>
+// Select is part of the runner.
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+UNIT(Test_Generator_Index) {
+  const auto range = microunit::Range(0, 10, 3);
+  ASSERT_TRUE(range.Size() == 4);
+  ASSERT_TRUE(range.At(0) == 0 && range.At(3) == 9);
+  ASSERT_TRUE(microunit::Range(0.0, 1.0, 0.25).Size() == 4);
+  ASSERT_TRUE(microunit::Range(0.0, 1.1, 0.25).Size() == 5);
+  ASSERT_TRUE(microunit::Range(5, 5).Size() == 0);
+  ASSERT_TRUE(microunit::Range(5, 0).Size() == 0);
+  ASSERT_TRUE(microunit::Range(0, 10, 0).Size() == 0);
+
+  const auto values = microunit::Values({ 'a', 'b' });
+  ASSERT_TRUE(values.Size() == 2 && values.At(1) == 'b');
+
+  // The last generator varies the fastest.
+  const auto product = microunit::Cartesian(microunit::Range(0, 3), values);
+  ASSERT_TRUE(product.Size() == 6);
+  ASSERT_TRUE(product.At(0) == std::make_tuple(0, 'a'));
+  ASSERT_TRUE(product.At(1) == std::make_tuple(0, 'b'));
+  ASSERT_TRUE(product.At(4) == std::make_tuple(2, 'a'));
+  ASSERT_TRUE(product.At(5) == std::make_tuple(2, 'b'));
+  ASSERT_TRUE(microunit::Cartesian(microunit::Range(0, 3),
+                                   microunit::Range(0, 0)).Size() == 0);
+
+  // Zip stops at the shortest generator.
+  const auto zip = microunit::Zip(microunit::Range(0, 5),
+                                  microunit::Values({ 10, 20, 30 }));
+  ASSERT_TRUE(zip.Size() == 3);
+  ASSERT_TRUE(zip.At(2) == std::make_tuple(2, 30));
+
+  const microunit::Selection some =
+    microunit::Select("Test_Sweep[3],Other,Test_Sweep[70003]", "Test_Sweep");
+  ASSERT_FALSE(some.all);
+  ASSERT_TRUE(some.indices.size() == 2 && some.indices[1] == 70003);
+  ASSERT_TRUE(microunit::Select("Test_Sw*", "Test_Sweep").all);
+  ASSERT_FALSE(microunit::Select("Test_Sw", "Test_Sweep").all);
+};
+
+int main(int argc, char **argv) {
+  return microunit::UnitTester::Main(argc, argv);
+}
@@ -0,0 +1,61 @@
+// Tests of the outcomes of test cases run in a child process by --isolate,
+// with and without resource limits. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/isolation_test.cpp -o isolation_test -pthread
+//   ./isolation_test
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+// RunIsolated is part of the runner.
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+UNIT(Test_Isolation_Outcomes) {
+  using microunit::TestOutcome;
+  const microunit::ResourceLimits none;
+  ASSERT_TRUE(microunit::RunIsolated([]() { return true; }, none, false) ==
+              TestOutcome::kPassed);
+  ASSERT_TRUE(microunit::RunIsolated([]() { return false; }, none, false) ==
+              TestOutcome::kFailed);
+  ASSERT_TRUE(microunit::RunIsolated([]() { abort(); return true; }, none,
+                                     false) == TestOutcome::kCrashed);
+  // Not a limit when the test case sets no address space limit.
+  ASSERT_TRUE(microunit::RunIsolated([]() { exit(125); return true; }, none,
+                                     false) == TestOutcome::kFailed);
+
+  microunit::ResourceLimits memory;
+  memory.address_space = size_t(1) << 30;
+  ASSERT_TRUE(microunit::RunIsolated([]() {
+    std::vector<char> hog(size_t(4) << 30, 1);
+    return hog.back() == 1;
+  }, memory, false) == TestOutcome::kMemoryLimit);
+  // A test case that handles the failed allocation passes.
+  ASSERT_TRUE(microunit::RunIsolated([]() {
+    try {
+      std::vector<char> hog(size_t(4) << 30, 1);
+      return false;
+    } catch (const std::bad_alloc&) {
+      return true;
+    }
+  }, memory, false) == TestOutcome::kPassed);
+
+  microunit::ResourceLimits cpu;
+  cpu.cpu_seconds = 1;
+  ASSERT_TRUE(microunit::RunIsolated([]() {
+    for (volatile unsigned long i = 0;; ++i) {}
+    return true;
+  }, cpu, false) == TestOutcome::kCpuLimit);
+
+  microunit::ResourceLimits output;
+  output.output_bytes = 64;
+  ASSERT_TRUE(microunit::RunIsolated([]() {
+    for (int i = 0; i < 100; ++i) puts("output limit");
+    fflush(stdout);
+    return true;
+  }, output, false) == TestOutcome::kOutputLimit);
+};
+
+int main(int argc, char **argv) {
+  return microunit::UnitTester::Main(argc, argv);
+}
@@ -0,0 +1,112 @@
+// Tests of --leaks: the threads and file descriptors that a test case leaves
+// open are listed, with their names and targets. Linux only.
+//
+//   g++ -std=c++11 -I. tests/leak_test.cpp -o leak_test -pthread
+//   ./leak_test
+//
+// The tests run this program again with "leaky" as first argument, which
+// registers the Leaky_* test cases instead.
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+// Run the Leaky_* test cases in a child process with OPTIONS, and return its
+// output.
+static std::string RunLeaky(const char *options) {
+  const std::string command = "'" + self_path + "' leaky " + options +
+    " 2>&1";
+  std::string output;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  pclose(pipe);
+  return output;
+}
+
+static bool Contains(const std::string& text, const char *part) {
+  return text.find(part) != std::string::npos;
+}
+
+// The output of the test case NAME, up to the next one.
+static std::string Section(const std::string& output, const char *name) {
+  const size_t start = output.find(std::string("Test case '") + name + "'");
+  if (start == std::string::npos) return std::string();
+  const size_t end = output.find("Test case '", start + 1);
+  return output.substr(start, end == std::string::npos ? end : end - start);
+}
+
+UNIT(Test_Leaks_Listed) {
+  const std::string output = RunLeaky("--leaks");
+  const std::string thread = Section(output, "Leaky_Thread");
+  ASSERT_TRUE(Contains(thread, "Leaked thread "));
+  ASSERT_TRUE(Contains(thread, " 'leaky-worker'"));
+  ASSERT_FALSE(Contains(thread, "Leaked file descriptor"));
+  const std::string fd = Section(output, "Leaky_Fd");
+  ASSERT_TRUE(Contains(fd, "Leaked file descriptor "));
+  ASSERT_TRUE(Contains(fd, " to /dev/null"));
+  ASSERT_FALSE(Contains(fd, "Leaked thread"));
+  // What a test case closes or joins is not a leak.
+  ASSERT_FALSE(Contains(Section(output, "Leaky_Clean"), "Leaked"));
+  // Only listed.
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+};
+
+UNIT(Test_Leaks_Fail) {
+  const std::string output = RunLeaky("--leaks=fail");
+  ASSERT_TRUE(Contains(output, "Failed 2 test cases"));
+  ASSERT_TRUE(Contains(output, "Passed 1 test cases"));
+};
+
+UNIT(Test_Leaks_Off) {
+  const std::string output = RunLeaky("");
+  ASSERT_FALSE(Contains(output, "Leaked"));
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+};
+
+static void RegisterLeaky() {
+  microunit::UnitTester::RegisterCallable("Leaky_Clean", UNIT_LAMBDA() {
+    const int fd = open("/dev/null", O_RDONLY);
+    ASSERT_TRUE(fd >= 0);
+    close(fd);
+    std::thread worker([]() {});
+    worker.join();
+  });
+  microunit::UnitTester::RegisterCallable("Leaky_Fd", UNIT_LAMBDA() {
+    ASSERT_TRUE(open("/dev/null", O_RDONLY) >= 0);
+  });
+  microunit::UnitTester::RegisterCallable("Leaky_Thread", UNIT_LAMBDA() {
+    // Named before the test case ends, and never ends.
+    static std::atomic<bool> named{ false };
+    std::thread([]() {
+      pthread_setname_np(pthread_self(), "leaky-worker");
+      named = true;
+      for (;;) pause();
+    }).detach();
+    while (!named) std::this_thread::yield();
+  });
+}
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  std::vector<char*> arguments(argv, argv + argc);
+  if (argc > 1 && strcmp(argv[1], "leaky") == 0) {
+    RegisterLeaky();
+    static char filter[] = "--filter=Leaky_*";
+    arguments[1] = filter;
+  } else {
+    static char filter[] = "--filter=Test_*";
+    arguments.insert(arguments.begin() + 1, filter);
+  }
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
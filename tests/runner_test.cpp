@@ -0,0 +1,202 @@
+// Tests of the journal of the runner: its parser and the merge of a resumed
+// run. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/runner_test.cpp -o runner_test -pthread
+//   ./runner_test
+//
+// The resume test runs this program again with "resume" as first argument,
+// which registers the test cases of a resumed run instead.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+// The tests use the internals of the runner.
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+// Create an empty temporary file, and return its path.
+static std::string TemporaryFile() {
+  char path[] = "/tmp/microunit_testXXXXXX";
+  const int fd = mkstemp(path);
+  if (fd >= 0) close(fd);
+  return path;
+}
+
+static void WriteFile(const std::string& path, const char *content) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file) return;
+  fputs(content, file);
+  fclose(file);
+}
+
+static std::string ReadFile(const std::string& path) {
+  std::string content;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) return content;
+  for (int c; (c = fgetc(file)) != EOF;) content += static_cast<char>(c);
+  fclose(file);
+  return content;
+}
+
+static bool Contains(const std::string& text, const char *part) {
+  return text.find(part) != std::string::npos;
+}
+
+UNIT(Test_Journal_Parse) {
+  const std::string path = TemporaryFile();
+  WriteFile(path,
+    "pass Test_Pass\n"
+    "fail Test_Fail\n"
+    // A failed test case whose name ends with brackets.
+    "fail Parse_[a]\n"
+    "start Test_Sweep\n"
+    "pfail Test_Sweep[3]\n"
+    "pfail Test_Sweep[7]\n"
+    "done 8 Test_Sweep\n"
+    // A parameter of a test case whose name has brackets too.
+    "start Parse_[b]\n"
+    "pfail Parse_[b][1]\n"
+    "done 1 Parse_[b]\n"
+    // Interrupted before its end.
+    "start Test_Cut\n"
+    "pfail Test_Cut[0]\n"
+    // Cut by a crash.
+    "pass Test_Tor");
+  microunit::Journal journal;
+  ASSERT_TRUE(journal.Open(path.c_str(), true));
+
+  const microunit::Journal::Entry *entry = journal.Find("Test_Pass");
+  ASSERT_TRUE(entry && entry->passed);
+  entry = journal.Find("Test_Fail");
+  ASSERT_TRUE(entry && !entry->passed);
+  entry = journal.Find("Parse_[a]");
+  ASSERT_TRUE(entry && !entry->passed && entry->failures.empty());
+  entry = journal.Find("Test_Sweep");
+  ASSERT_TRUE(entry && entry->passed_parameters == 8);
+  ASSERT_TRUE(entry->failures.size() == 2);
+  ASSERT_TRUE(entry->failures[1] == "Test_Sweep[7]");
+  entry = journal.Find("Parse_[b]");
+  ASSERT_TRUE(entry && entry->passed_parameters == 1);
+  ASSERT_TRUE(entry->failures.size() == 1);
+  ASSERT_TRUE(journal.Find("Test_Cut") == nullptr);
+  ASSERT_TRUE(journal.Find("Test_Tor") == nullptr);
+  ASSERT_TRUE(journal.Find("Test_Unknown") == nullptr);
+
+  // New records replace the cut line.
+  journal.Append("pass", "Test_Torn");
+  journal.Close();
+  const std::string content = ReadFile(path);
+  unlink(path.c_str());
+  ASSERT_TRUE(Contains(content, "pfail Test_Cut[0]\npass Test_Torn\n"));
+  ASSERT_FALSE(Contains(content, "Test_Tor\n"));
+};
+
+UNIT(Test_Journal_Escape) {
+  // Names registered at run time may hold any character.
+  const std::string path = TemporaryFile();
+  const std::string broken = "Line\nbreak";
+  const std::string slashed = "Back\\slash\\n";
+  microunit::Journal journal;
+  ASSERT_TRUE(journal.Open(path.c_str(), false));
+  journal.Append("pass", broken);
+  journal.Append("start", slashed);
+  journal.Append("pfail", slashed + "[2]");
+  journal.Append("done", "4 " + slashed);
+  journal.Close();
+  const std::string content = ReadFile(path);
+  ASSERT_TRUE(content == "pass Line\\nbreak\n"
+                         "start Back\\\\slash\\\\n\n"
+                         "pfail Back\\\\slash\\\\n[2]\n"
+                         "done 4 Back\\\\slash\\\\n\n");
+
+  microunit::Journal resumed;
+  ASSERT_TRUE(resumed.Open(path.c_str(), true));
+  resumed.Close();
+  unlink(path.c_str());
+  const microunit::Journal::Entry *entry = resumed.Find(broken);
+  ASSERT_TRUE(entry && entry->passed);
+  ASSERT_TRUE(resumed.Find("Line") == nullptr);
+  entry = resumed.Find(slashed);
+  ASSERT_TRUE(entry && entry->passed_parameters == 4);
+  ASSERT_TRUE(entry->failures.size() == 1);
+  ASSERT_TRUE(entry->failures[0] == slashed + "[2]");
+};
+
+UNIT(Test_Resume_Merge) {
+  const std::string path = TemporaryFile();
+  WriteFile(path,
+    "pass Resume_Pass\n"
+    "fail Resume_[a]\n"
+    "start Resume_Sweep\n"
+    "pfail Resume_Sweep[1]\n"
+    "done 2 Resume_Sweep\n"
+    "start Resume_Cut\n"
+    "pfail Resume_Cut[0]\n");
+  const std::string command = "'" + self_path + "' resume --journal=" + path +
+    " --resume 2>&1";
+  FILE *pipe = popen(command.c_str(), "r");
+  ASSERT_TRUE(pipe != nullptr);
+  std::string output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  const int status = pclose(pipe);
+  const std::string journal = ReadFile(path);
+  unlink(path.c_str());
+
+  // Resume_Pass, Resume_[a] and the 3 parameters of Resume_Sweep are merged,
+  // Resume_Cut and Resume_New run.
+  ASSERT_TRUE(Contains(output, "Resuming after 5 test cases"));
+  ASSERT_TRUE(Contains(output, "Will run 3 test cases"));
+  ASSERT_TRUE(Contains(output, "Failed 3 test cases"));
+  ASSERT_TRUE(Contains(output, "Resume_Sweep[1]"));
+  ASSERT_TRUE(Contains(output, "Resume_Cut[0]"));
+  ASSERT_FALSE(Contains(output, "Test case 'Resume_Pass'"));
+  ASSERT_FALSE(Contains(output, "Test case 'Resume_[a]'"));
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+  ASSERT_TRUE(Contains(journal, "start Resume_Cut\npfail Resume_Cut[0]\n"
+                                "done 1 Resume_Cut\n"));
+  ASSERT_TRUE(Contains(journal, "pass Resume_New\n"));
+};
+
+// The test cases of the resumed run. Those found in the journal fail if they
+// run again.
+static void RegisterResumed() {
+  microunit::UnitTester::RegisterCallable("Resume_Pass", UNIT_LAMBDA() {
+    FAIL();
+  });
+  microunit::UnitTester::RegisterCallable("Resume_[a]", UNIT_LAMBDA() {
+    FAIL();
+  });
+  microunit::UnitTester::RegisterParameterized("Resume_Sweep",
+    microunit::Range(0, 3),
+    [](microunit::UnitFunctionResult *__microunit_testresult, int) {
+      FAIL();
+    });
+  microunit::UnitTester::RegisterParameterized("Resume_Cut",
+    microunit::Range(0, 2),
+    [](microunit::UnitFunctionResult *__microunit_testresult, int param) {
+      ASSERT_TRUE(param != 0);
+    });
+  microunit::UnitTester::RegisterCallable("Resume_New", UNIT_LAMBDA() {
+    PASS();
+  });
+}
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  if (argc > 1 && strcmp(argv[1], "resume") == 0) {
+    RegisterResumed();
+    // Only the test cases of the resumed run.
+    static char filter[] = "--filter=Resume_*";
+    std::vector<char*> arguments(argv + 1, argv + argc);
+    arguments[0] = argv[0];
+    arguments.push_back(filter);
+    return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                       arguments.data());
+  }
+  return microunit::UnitTester::Main(argc, argv);
+}
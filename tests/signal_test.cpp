@@ -0,0 +1,134 @@
+// Tests of the stop of UnitTester::Main on SIGINT and SIGTERM: the test case
+// that is running completes, the journal and the partial summary are
+// written, and the exit code is 128 plus the signal number. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/signal_test.cpp -o signal_test -pthread
+//   ./signal_test
+//
+// The tests run this program again with "stopped SIGNAL COUNT" as first
+// arguments, which runs the Stop_* test cases, the second of which sends
+// SIGNAL to the process COUNT times.
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+static int stop_signal = 0;
+static int stop_count = 0;
+
+UNIT(Stop_A) {
+  PASS();
+};
+
+UNIT(Stop_B) {
+  for (int i = 0; i < stop_count; ++i) kill(getpid(), stop_signal);
+  // Still runs to its end.
+  ASSERT_TRUE(true);
+};
+
+UNIT(Stop_C) {
+  FAIL();
+};
+
+struct Stopped {
+  std::string output;
+  std::string journal;
+  int status;
+};
+
+// Run the Stop_* test cases in a child process, and return its output, its
+// journal and its wait status.
+static Stopped RunStopped(int signal_number, int count) {
+  Stopped stopped{ std::string(), std::string(), -1 };
+  char journal_path[] = "/tmp/microunit_testXXXXXX";
+  const int journal_fd = mkstemp(journal_path);
+  if (journal_fd < 0) return stopped;
+  close(journal_fd);
+  int fds[2];
+  if (pipe(fds) != 0) return stopped;
+  const std::string signal_text = std::to_string(signal_number);
+  const std::string count_text = std::to_string(count);
+  const std::string journal = std::string("--journal=") + journal_path;
+  const pid_t child = fork();
+  if (child == 0) {
+    dup2(fds[1], 1);
+    dup2(fds[1], 2);
+    close(fds[0]);
+    close(fds[1]);
+    execl(self_path.c_str(), self_path.c_str(), "stopped",
+          signal_text.c_str(), count_text.c_str(), journal.c_str(),
+          static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  close(fds[1]);
+  char buffer[4096];
+  for (ssize_t size; (size = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+    stopped.output.append(buffer, static_cast<size_t>(size));
+  }
+  close(fds[0]);
+  if (child > 0) waitpid(child, &stopped.status, 0);
+  FILE *file = fopen(journal_path, "rb");
+  if (file) {
+    for (int c; (c = fgetc(file)) != EOF;) {
+      stopped.journal += static_cast<char>(c);
+    }
+    fclose(file);
+  }
+  unlink(journal_path);
+  return stopped;
+}
+
+static bool Contains(const std::string& text, const char *part) {
+  return text.find(part) != std::string::npos;
+}
+
+UNIT(Test_Signal_Interrupt) {
+  const Stopped stopped = RunStopped(SIGINT, 1);
+  ASSERT_TRUE(WIFEXITED(stopped.status) && WEXITSTATUS(stopped.status) == 130);
+  ASSERT_TRUE(Contains(stopped.output, "Stopped by signal 2 after 2 of 3"));
+  ASSERT_FALSE(Contains(stopped.output, "Test case 'Stop_C'"));
+  ASSERT_FALSE(Contains(stopped.output, "All tests passed"));
+  ASSERT_TRUE(stopped.journal == "pass Stop_A\npass Stop_B\n");
+};
+
+UNIT(Test_Signal_Terminate) {
+  const Stopped stopped = RunStopped(SIGTERM, 1);
+  ASSERT_TRUE(WIFEXITED(stopped.status) && WEXITSTATUS(stopped.status) == 143);
+  ASSERT_TRUE(Contains(stopped.output, "Stopped by signal 15 after 2 of 3"));
+  ASSERT_TRUE(stopped.journal == "pass Stop_A\npass Stop_B\n");
+};
+
+UNIT(Test_Signal_Twice) {
+  // The second signal terminates the process in the middle of Stop_B.
+  const Stopped stopped = RunStopped(SIGINT, 2);
+  ASSERT_TRUE(WIFSIGNALED(stopped.status) &&
+              WTERMSIG(stopped.status) == SIGINT);
+  ASSERT_FALSE(Contains(stopped.output, "Stopped by signal"));
+  ASSERT_TRUE(stopped.journal == "pass Stop_A\n");
+};
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  if (argc > 3 && strcmp(argv[1], "stopped") == 0) {
+    stop_signal = atoi(argv[2]);
+    stop_count = atoi(argv[3]);
+    static char filter[] = "--filter=Stop_*";
+    std::vector<char*> arguments(argv + 3, argv + argc);
+    arguments[0] = filter;
+    arguments.insert(arguments.begin(), argv[0]);
+    return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                       arguments.data());
+  }
+  static char filter[] = "--filter=Test_*";
+  std::vector<char*> arguments(argv, argv + argc);
+  arguments.insert(arguments.begin() + 1, filter);
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
@@ -0,0 +1,121 @@
+// Tests of the painted stacks of --stack: the high-water mark of a test case,
+// ASSERT_STACK_AT_MOST, and the guard page below the stack. POSIX only.
+//
+//   g++ -std=c++11 -I. tests/stack_test.cpp -o stack_test -pthread
+//   ./stack_test
+//
+// The tests run this program again with "deep" as first argument, which
+// registers the Deep_* test cases instead.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+// Use about LEVELS times 4 KB of stack.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static int UseStack(int levels) {
+  volatile char frame[4096];
+  frame[0] = static_cast<char>(levels);
+  frame[sizeof(frame) - 1] = frame[0];
+  if (levels <= 1) return frame[sizeof(frame) - 1];
+  return UseStack(levels - 1) + frame[0];
+}
+
+// Run the Deep_* test cases NAME in a child process with OPTIONS, and return
+// its output.
+static std::string RunDeep(const char *name, const char *options) {
+  const std::string command = "'" + self_path + "' deep --filter=" + name +
+    " " + options + " 2>&1";
+  std::string output;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  pclose(pipe);
+  return output;
+}
+
+static bool Contains(const std::string& text, const char *part) {
+  return text.find(part) != std::string::npos;
+}
+
+// The bytes in the "Stack: used N of" line of OUTPUT, or 0.
+static size_t UsedStack(const std::string& output) {
+  const size_t line = output.find("Stack: used ");
+  if (line == std::string::npos) return 0;
+  return static_cast<size_t>(atoll(output.c_str() + line + 12));
+}
+
+UNIT(Test_Stack_High_Water) {
+  const size_t before = microunit::StackHighWater();
+  ASSERT_TRUE(before > 0 && before < 16384);
+  ASSERT_TRUE(UseStack(16) > 0);
+  const size_t after = microunit::StackHighWater();
+  ASSERT_TRUE(after >= before + 16 * 4096 && after < 32 * 4096);
+  // The mark stays at the deepest point.
+  ASSERT_TRUE(microunit::StackHighWater() == after);
+  ASSERT_STACK_AT_MOST(32 * 4096);
+};
+
+UNIT(Test_Stack_Logged) {
+  const std::string output = RunDeep("Deep_Use", "--stack=1048576");
+  const size_t used = UsedStack(output);
+  ASSERT_TRUE(used >= 64 * 4096 && used < 80 * 4096);
+  ASSERT_TRUE(Contains(output, " of 1048576 bytes"));
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+};
+
+UNIT(Test_Stack_Assert) {
+  const std::string output = RunDeep("Deep_Assert", "--stack=1048576");
+  ASSERT_TRUE(Contains(output, "Assert-stack failed: stack <= 128 * 1024"));
+  ASSERT_FALSE(Contains(output, "All tests passed"));
+};
+
+UNIT(Test_Stack_Unpainted) {
+  // Without --stack, there is no mark and the assertion always holds.
+  const std::string output = RunDeep("Deep_Assert", "");
+  ASSERT_FALSE(Contains(output, "Stack: used"));
+  ASSERT_TRUE(Contains(output, "All tests passed"));
+};
+
+UNIT(Test_Stack_Overflow) {
+  // The guard page turns an overflow into a crash of the test case, and the
+  // run goes on.
+  const std::string output = RunDeep("Deep_*", "--stack=131072 --isolate");
+  ASSERT_TRUE(Contains(output, "Crashed with signal"));
+  ASSERT_TRUE(Contains(output, "Test case 'Deep_Use'"));
+  ASSERT_TRUE(Contains(output, "Failed 2 test cases"));
+};
+
+static void RegisterDeep() {
+  microunit::UnitTester::RegisterCallable("Deep_Use", UNIT_LAMBDA() {
+    ASSERT_TRUE(UseStack(64) > 0);
+  });
+  microunit::UnitTester::RegisterCallable("Deep_Assert", UNIT_LAMBDA() {
+    ASSERT_TRUE(UseStack(64) > 0);
+    ASSERT_STACK_AT_MOST(128 * 1024);
+  });
+}
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  std::vector<char*> arguments(argv, argv + argc);
+  if (argc > 1 && strcmp(argv[1], "deep") == 0) {
+    RegisterDeep();
+    arguments.erase(arguments.begin() + 1);
+  } else {
+    // The test cases of this program run on a painted stack.
+    static char stack[] = "--stack=1048576";
+    static char filter[] = "--filter=Test_*";
+    arguments.insert(arguments.begin() + 1, filter);
+    arguments.insert(arguments.begin() + 1, stack);
+  }
+  return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                     arguments.data());
+}
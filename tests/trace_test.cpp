@@ -0,0 +1,83 @@
+// Tests of --trace-syscalls: the syscalls of every thread of an isolated test
+// case are counted. Linux only.
+//
+//   g++ -std=c++11 -I. tests/trace_test.cpp -o trace_test -pthread
+//   ./trace_test
+//
+// The tests run this program again with "traced" as first argument, which
+// registers the traced test cases instead.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#define MICROUNIT_IMPLEMENTATION
+#include "microunit.h"
+
+static std::string self_path;
+
+// Run the traced test case NAME in a child process with OPTIONS, and return
+// the number of writes it logged, or -1.
+static long TracedWrites(const char *name, const char *options) {
+  const std::string command = "'" + self_path + "' traced --filter=" + name +
+    " --trace-syscalls " + options + " 2>&1";
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return -1;
+  std::string output;
+  for (int c; (c = fgetc(pipe)) != EOF;) output += static_cast<char>(c);
+  pclose(pipe);
+  const size_t line = output.find("Syscalls: ");
+  if (line == std::string::npos) return -1;
+  // Either the first count of the line or one after a comma.
+  for (const char *prefix : { "Syscalls: write ", ", write " }) {
+    const size_t count = output.find(prefix, line);
+    if (count != std::string::npos && output.find('\n', line) > count) {
+      return atol(output.c_str() + count + strlen(prefix));
+    }
+  }
+  return 0;
+}
+
+static void WriteTimes(int times) {
+  for (int i = 0; i < times; ++i) {
+    if (write(1, ".", 1) != 1) return;
+  }
+}
+
+UNIT(Test_Trace_Main) {
+  ASSERT_TRUE(TracedWrites("Traced_Main", "") >= 50);
+};
+
+UNIT(Test_Trace_Stack) {
+  // The test case runs on the painted stack thread.
+  ASSERT_TRUE(TracedWrites("Traced_Main", "--stack=1048576") >= 50);
+};
+
+UNIT(Test_Trace_Thread) {
+  ASSERT_TRUE(TracedWrites("Traced_Thread", "") >= 50);
+  ASSERT_TRUE(TracedWrites("Traced_Thread", "--stack=1048576") >= 50);
+};
+
+static void RegisterTraced() {
+  microunit::UnitTester::RegisterCallable("Traced_Main", UNIT_LAMBDA() {
+    WriteTimes(50);
+  });
+  microunit::UnitTester::RegisterCallable("Traced_Thread", UNIT_LAMBDA() {
+    std::thread writer(WriteTimes, 50);
+    writer.join();
+  });
+}
+
+int main(int argc, char **argv) {
+  self_path = argv[0];
+  if (argc > 1 && strcmp(argv[1], "traced") == 0) {
+    RegisterTraced();
+    std::vector<char*> arguments(argv + 1, argv + argc);
+    arguments[0] = argv[0];
+    return microunit::UnitTester::Main(static_cast<int>(arguments.size()),
+                                       arguments.data());
+  }
+  return microunit::UnitTester::Main(argc, argv);
+}